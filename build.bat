@@ -11,8 +11,12 @@ pushd build
 del *.pdb
 
 echo WAITING FOR PDB > lock.tmp
-cl %common_flags% -LD ..\src\game.cpp -link -opt:ref -INCREMENTAL:NO %subsystem% -EXPORT:update_and_render -EXPORT:get_sound_samples
+cl %common_flags% -LD ..\src\game.cpp -link -opt:ref -INCREMENTAL:NO %subsystem% -EXPORT:simulate -EXPORT:render -EXPORT:get_sound_samples -EXPORT:scan_world -EXPORT:release_world
 del lock.tmp
 
-cl %common_flags% ..\src\win32_handmade.cpp gdi32.lib user32.lib winmm.lib -link -opt:ref -INCREMENTAL:NO %subsystem%
+cl %common_flags% ..\src\win32_handmade.cpp advapi32.lib gdi32.lib user32.lib winmm.lib -link -opt:ref -INCREMENTAL:NO %subsystem%
+
+@REM setargv.obj раскрывает *.bmp в аргументах
+cl %common_flags% ..\src\asset_packer.cpp -link -opt:ref -INCREMENTAL:NO setargv.obj
+IF EXIST ..\data\test asset_packer.exe ..\data\assets.hma ..\data\test\*.bmp
 popd
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include "globals.hpp"
+#include "intrinsics.hpp"
+#include "files.cpp"
+#include "assets.cpp"
+#include <cstdio>
+#include <cstdlib>
+
+// asset_packer <pack> <bmp>..., собирает пак для Assets::load_pack. Битмап в паке называется по имени файла без папки и расширения
+static constexpr i64 PACKER_MEMORY_SIZE = 1_GB;
+
+// пустой slice если файла нет, он пустой, не влезает в арену или не прочитался
+static slice<u8> read_entire_file(Arena& arena, cstr file_name) {
+	FILE* stream = nullptr;
+	if (fopen_s(&stream, file_name, "rb") || !stream) return {};
+	defer(fclose(stream));
+
+	fseek(stream, 0, SEEK_END);
+	i64 file_size = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+	if (file_size <= 0 || arena.used + file_size + CACHE_LINE_SIZE > arena.size) return {};
+
+	auto temp = arena.begin_temp();
+	slice<u8> file = { arena.push<u8>(file_size, CACHE_LINE_SIZE), file_size };
+	if (cast<i64>(fread(file.ptr, 1, cast<size_t>(file_size), stream)) != file_size) {
+		arena.end_temp(temp);
+		return {};
+	}
+	return file;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		printf("usage: asset_packer <pack> <bmp>...\n");
+		return 1;
+	}
+	cstr pack_file_name = argv[1];
+	slice<char*> bmp_file_names = { argv + 2, argc - 2 };
+
+	Arena arena = { cast<u8*>(calloc(1, PACKER_MEMORY_SIZE)), PACKER_MEMORY_SIZE };
+	if (!arena.ptr) return 1;
+
+	// пак собирается целиком в памяти и пишется одним куском, смещения в нём считаются от начала pack_arena
+	Arena pack_arena = arena.push_arena(PACKER_MEMORY_SIZE / 2, Assets::PACK_FILE_PIXELS_ALIGN);
+
+	auto& header = *pack_arena.push<Assets::Pack_File_Header>(size_of(Assets::Pack_File_Header));
+	header.magic         = Assets::PACK_FILE_MAGIC;
+	header.version       = Assets::PACK_FILE_VERSION;
+	header.index_offset  = pack_arena.used;
+	header.entries_count = bmp_file_names.count;
+
+	slice<Assets::Pack_Entry> entries = {};
+	entries.count = bmp_file_names.count;
+	entries.ptr = pack_arena.push<Assets::Pack_Entry>(entries.get_size());
+
+	for (i64 entry_index = 0; entry_index < entries.count; ++entry_index) {
+		auto& entry = entries(entry_index);
+		cstr bmp_file_name = bmp_file_names(entry_index);
+
+		auto temp = arena.begin_temp();
+		defer(arena.end_temp(temp));
+
+		slice<u8> file = read_entire_file(arena, bmp_file_name);
+		if (!file.ptr) {
+			printf("asset_packer: can't read %s\n", bmp_file_name);
+			return 1;
+		}
+
+		Assets::copy_asset_name(entry.name, bmp_file_name);
+		for (i64 other_index = 0; other_index < entry_index; ++other_index) {
+			if (!Assets::check_asset_name(entries(other_index).name, entry.name.ptr)) continue;
+			printf("asset_packer: duplicate name %s in %s\n", entry.name.ptr, bmp_file_name);
+			return 1;
+		}
+
+		slice2<u32> bitmap = Assets::convert_bmp(file);
+		if (!bitmap.ptr) {
+			printf("asset_packer: %s is not a 32-bit BMP with channel masks\n", bmp_file_name);
+			return 1;
+		}
+		if (pack_arena.used + bitmap.get_size() + Assets::PACK_FILE_PIXELS_ALIGN > pack_arena.size) {
+			printf("asset_packer: pack is over %lld MB at %s\n", PACKER_MEMORY_SIZE / 2 / 1_MB, bmp_file_name);
+			return 1;
+		}
+		u32* pixels = pack_arena.push<u32>(bitmap.get_size(), Assets::PACK_FILE_PIXELS_ALIGN);
+		hm::memcpy(pixels, bitmap.ptr, cast<size_t>(bitmap.get_size()));
+
+		entry.count = bitmap.count;
+		entry.pixels_offset = cast<u8*>(pixels) - pack_arena.ptr;
+	}
+
+	FILE* stream = nullptr;
+	if (fopen_s(&stream, pack_file_name, "wb") || !stream) {
+		printf("asset_packer: can't write %s\n", pack_file_name);
+		return 1;
+	}
+	defer(fclose(stream));
+
+	bool ok_write = cast<i64>(fwrite(pack_arena.ptr, 1, cast<size_t>(pack_arena.used), stream)) == pack_arena.used;
+	if (!ok_write) {
+		printf("asset_packer: can't write %s\n", pack_file_name);
+		return 1;
+	}
+
+	printf("%s: %lld bitmaps, %.2f MB\n", pack_file_name, entries.count, cast<f64>(pack_arena.used) / 1_MB);
+	return 0;
+}
\ No newline at end of file
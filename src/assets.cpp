@@ -0,0 +1,299 @@
+#include "assets.hpp"
+
+namespace Assets {
+	// false если файла нет или он устарел, тогда пак пустой
+	static bool load_pack(Pack& pack, slice<u8> file) {
+		pack = {};
+		if (file.get_size() < size_of(Pack_File_Header)) return false;
+
+		// количество и размеры проверяем до умножения, чтобы битый файл не переполнил i64
+		auto& header = cast<Pack_File_Header&>(*file.ptr);
+		bool is_valid = header.magic == PACK_FILE_MAGIC &&
+		                header.version == PACK_FILE_VERSION &&
+		                header.index_offset >= size_of(Pack_File_Header) &&
+		                header.index_offset % alignof(Pack_Entry) == 0 &&
+		                header.index_offset <= file.get_size() &&
+		                header.entries_count >= 0 &&
+		                header.entries_count <= (file.get_size() - header.index_offset) / size_of(Pack_Entry);
+		if (!is_valid) return false;
+
+		slice<Pack_Entry> entries = { cast<Pack_Entry*>(file.ptr + header.index_offset), header.entries_count };
+		i64 index_end = header.index_offset + entries.get_size();
+		for (auto& entry : entries) {
+			if (entry.count.x < 0 || entry.count.y < 0 ||
+			    entry.pixels_offset < index_end ||
+			    entry.pixels_offset > file.get_size() ||
+			    entry.pixels_offset % PACK_FILE_PIXELS_ALIGN != 0) return false;
+
+			i64 row_size = size_of(u32) * entry.count.x;
+			if (row_size && entry.count.y > (file.get_size() - entry.pixels_offset) / row_size) return false;
+		}
+
+		pack.file = file;
+		pack.entries = entries;
+		return true;
+	}
+
+	// пустой slice2 если такого битмапа в паке нет
+	static slice2<u32> find_bitmap(Pack& pack, cstr name) {
+		for (auto& entry : pack.entries) {
+			if (!check_asset_name(entry.name, name)) continue;
+			return { cast<u32*>(pack.file.ptr + entry.pixels_offset), entry.count };
+		}
+		return {};
+	}
+
+	// пустой slice2, пока битмап не загружен. Первый вызов ставит его в очередь
+	static slice2<u32> get_bitmap(Game::Thread& thread, Loader& loader, Asset_Id::Type id) {
+		auto& asset = loader.assets(id);
+		asset.last_used_frame = loader.frame_index;
+		if (asset.state == Asset_State::Unloaded) request_asset(thread, loader, id);
+
+		bool is_loaded = asset.state == Asset_State::Loaded;
+		if (is_loaded) loader.cache.stats.hits   += 1;
+		else           loader.cache.stats.misses += 1;
+		return is_loaded ? asset.bitmap : slice2<u32>{};
+	}
+
+	// заранее, чтобы к первому кадру с ассетом он уже был готов. Без свободной задачи или места в кэше повторим при следующей просьбе
+	static void request_asset(Game::Thread& thread, Loader& loader, Asset_Id::Type id) {
+		auto& asset = loader.assets(id);
+		asset.last_used_frame = loader.frame_index;
+		if (asset.state != Asset_State::Unloaded) return;
+
+		auto* job = get_free_load_job(loader);
+		if (!job) return;
+
+		start_load_job(thread, loader, *job, id);
+	}
+
+	// раз в кадр на главном потоке
+	static void update_loader(Game::Thread& thread, Loader& loader) {
+		loader.frame_index += 1;
+		for (auto& job : loader.jobs) {
+			if (job.is_used && job.is_done) finish_load_job(thread, loader, job);
+		}
+	}
+
+	static Load_Job* get_free_load_job(Loader& loader) {
+		for (auto& job : loader.jobs) {
+			if (!job.is_used) return &job;
+		}
+		return nullptr;
+	}
+
+	// битмап из пака берётся прямо из отображения, BMP без пака грузится в два захода: размер файла узнаёт фоновый поток,
+	// потом главный выделяет под него кусок кэша и снова отдаёт задачу на чтение
+	static void start_load_job(Game::Thread& thread, Loader& loader, Load_Job& job, Asset_Id::Type id) {
+		auto& asset = loader.assets(id);
+		cstr name = ASSET_NAMES[id];
+
+		job = {};
+		job.loader = &loader;
+		job.id = id;
+		job.is_used = true;
+		job.pack_bitmap = find_bitmap(loader.pack, name);
+
+		if (!job.pack_bitmap.ptr) {
+			assert_or_return_void(cast<i32>(strlen(name) + strlen("test/.bmp")) < job.file_name.get_count(), {
+				asset.state = Asset_State::Failed;
+				job = {};
+			});
+			strcat(job.file_name.ptr, "test/");
+			strcat(job.file_name.ptr, name);
+			strcat(job.file_name.ptr, ".bmp");
+		}
+
+		asset.state = Asset_State::Loading;
+		if (loader.queue) loader.add_work(thread, *loader.queue, do_load_job, &job);
+		else              do_load_job(thread, &job);
+	}
+
+	// кэш меняется только здесь, на главном потоке, фоновый поток только заполняет свой кусок
+	static void finish_load_job(Game::Thread& thread, Loader& loader, Load_Job& job) {
+		auto& asset = loader.assets(job.id);
+		assert(asset.state == Asset_State::Loading);
+
+		if (!job.pack_bitmap.ptr && !job.memory.ptr) {
+			// не влезет даже в пустой кэш
+			i64 size = job.file_size;
+			if (size <= 0 || size + CACHE_BLOCK_HEADER_SIZE > loader.cache.stats.size) {
+				asset.state = Asset_State::Failed;
+				job = {};
+				return;
+			}
+
+			// без места в кэше повторим при следующей просьбе
+			job.memory = { alloc_asset_memory(loader, size), size };
+			if (!job.memory.ptr) {
+				asset.state = Asset_State::Unloaded;
+				job = {};
+				return;
+			}
+
+			asset.memory = job.memory.ptr;
+			job.is_done = false;
+			if (loader.queue) loader.add_work(thread, *loader.queue, do_load_job, &job);
+			else              do_load_job(thread, &job);
+			return;
+		}
+
+		if (job.ok) {
+			asset.state = Asset_State::Loaded;
+			asset.bitmap = job.bitmap;
+		} else {
+			if (asset.memory) free_cache_block(loader.cache, asset.memory);
+			asset.state = Asset_State::Failed;
+			asset.memory = nullptr;
+		}
+		job = {};
+	}
+
+	// выполняется в фоновом потоке, трогает только job и его кусок кэша. Страницы пака только подгружаются с диска,
+	// чтобы первый кадр с битмапом не ждал диска, и остаются чистыми страницами файла, которые система может выбросить
+	static void do_load_job(Game::Thread& thread, void* data) {
+		auto& job = *cast<Load_Job*>(data);
+		auto& loader = *job.loader;
+
+		if (job.pack_bitmap.ptr) {
+			slice<u8> pixels = { job.pack_bitmap.ptr, job.pack_bitmap.count.x * job.pack_bitmap.count.y };
+			u8 sum = 0;
+			for (i64 offset = 0; offset < pixels.count; offset += PAGE_SIZE) sum += cast<volatile u8&>(pixels.ptr[offset]);
+			job.bitmap = job.pack_bitmap;
+			job.ok = true;
+		} else if (!job.memory.ptr) {
+			job.file_size = loader.get_file_size(thread, job.file_name.ptr);
+		} else {
+			Arena file_arena = { job.memory.ptr, job.memory.get_size() }; // кусок кэша ровно под файл
+			slice<u8> file = Files::read_entire_file(thread, loader.get_file_size, loader.read_file, file_arena, job.file_name.ptr);
+			if (file.ptr) job.bitmap = convert_bmp(file);
+			job.ok = job.bitmap.ptr != nullptr;
+		}
+		job.is_done = true;
+	}
+
+	// при нехватке места выгружает по одному самый давно использованный ассет. nullptr, если всё занятое нужно в этом кадре
+	static u8* alloc_asset_memory(Loader& loader, i64 size) {
+		while (true) {
+			u8* memory = alloc_cache_block(loader.cache, size);
+			if (memory) return memory;
+
+			Asset* victim = nullptr;
+			for (auto& asset : loader.assets) {
+				if (asset.state != Asset_State::Loaded || !asset.memory || asset.last_used_frame == loader.frame_index) continue;
+				if (!victim || asset.last_used_frame < victim->last_used_frame) victim = &asset;
+			}
+			if (!victim) return nullptr;
+
+			free_cache_block(loader.cache, victim->memory);
+			*victim = {};
+			loader.cache.stats.evictions += 1;
+		}
+	}
+
+	static void init_cache(Cache& cache, slice<u8> memory) {
+		assert_or_return_void(memory.get_size() > CACHE_BLOCK_HEADER_SIZE);
+		assert(cast<u64>(memory.ptr) % CACHE_BLOCK_ALIGN == 0);
+
+		cache = {};
+		cache.first = cast<Cache_Block*>(memory.ptr);
+		*cache.first = {};
+		cache.first->size = (memory.get_size() - CACHE_BLOCK_HEADER_SIZE) & ~(CACHE_BLOCK_ALIGN - 1);
+		cache.stats.size = memory.get_size();
+	}
+
+	// первый подходящий свободный кусок, остаток отделяется, если в него влезет хоть что-то
+	static u8* alloc_cache_block(Cache& cache, i64 size) {
+		size = (size + CACHE_BLOCK_ALIGN - 1) & ~(CACHE_BLOCK_ALIGN - 1);
+
+		for (auto* block = cache.first; block; block = block->next) {
+			if (block->is_used || block->size < size) continue;
+
+			if (block->size - size >= CACHE_BLOCK_HEADER_SIZE + CACHE_BLOCK_ALIGN) {
+				auto* rest = cast<Cache_Block*>(cast<u8*>(block) + CACHE_BLOCK_HEADER_SIZE + size);
+				*rest = {};
+				rest->prev = block;
+				rest->next = block->next;
+				rest->size = block->size - size - CACHE_BLOCK_HEADER_SIZE;
+				if (rest->next) rest->next->prev = rest;
+				block->next = rest;
+				block->size = size;
+			}
+
+			block->is_used = true;
+			cache.stats.used_size += block->size;
+			return cast<u8*>(block) + CACHE_BLOCK_HEADER_SIZE;
+		}
+		return nullptr;
+	}
+
+	// свободные соседи сливаются, поэтому два свободных куска рядом не лежат
+	static void free_cache_block(Cache& cache, u8* memory) {
+		auto* block = cast<Cache_Block*>(memory - CACHE_BLOCK_HEADER_SIZE);
+		assert_or_return_void(block->is_used);
+
+		block->is_used = false;
+		cache.stats.used_size -= block->size;
+		if (block->next && !block->next->is_used) merge_cache_blocks(*block, *block->next);
+		if (block->prev && !block->prev->is_used) merge_cache_blocks(*block->prev, *block);
+	}
+
+	static void merge_cache_blocks(Cache_Block& first, Cache_Block& second) {
+		assert(second.prev == &first);
+		first.size += CACHE_BLOCK_HEADER_SIZE + second.size;
+		first.next = second.next;
+		if (first.next) first.next->prev = &first;
+	}
+
+	// пиксели переводятся на месте в 0xAARRGGBB и остаются рядом с заголовком, строки снизу вверх.
+	// Пустой битмап, если это не 32-битный BMP с масками каналов или размер пикселей не сходится с файлом
+	static slice2<u32> convert_bmp(slice<u8> file) {
+		if (file.get_size() < size_of(Bmp_Header)) return {};
+
+		auto& header = cast<Bmp_Header&>(*file.ptr);
+		if (header.file_type != 0x4D42 || header.compression != 3 || header.bits_per_pixel != 32) return {};
+		if (header.width <= 0 || header.height <= 0 || header.bitmap_offset > file.get_size()) return {};
+		if (cast<i64>(header.width) * header.height * size_of(u32) != file.get_size() - header.bitmap_offset) return {};
+
+		u32 alpha_mask = ~(header.red_mask | header.green_mask | header.blue_mask);
+		result<i32> alpha_shift = hm::find_set_bit_right(alpha_mask);
+		result<i32> red_shift   = hm::find_set_bit_right(header.red_mask);
+		result<i32> green_shift = hm::find_set_bit_right(header.green_mask);
+		result<i32> blue_shift  = hm::find_set_bit_right(header.blue_mask);
+		if (!alpha_shift.ok || !red_shift.ok || !green_shift.ok || !blue_shift.ok) return {};
+
+		slice2<u32> pixels = {};
+		pixels.count = { header.width, header.height };
+		pixels.ptr = cast<u32*>(file.ptr + header.bitmap_offset);
+
+		for (u32& pixel : pixels) {
+			pixel = ((pixel & alpha_mask)        >> alpha_shift.value << 24) |
+			        ((pixel & header.red_mask)   >> red_shift.value   << 16) |
+					((pixel & header.green_mask) >> green_shift.value << 8)  |
+					((pixel & header.blue_mask)  >> blue_shift.value  << 0);
+		}
+
+		return pixels;
+	}
+
+	// без папки и расширения, обрезается по размеру
+	static void copy_asset_name(Array<char, ASSET_NAME_SIZE>& dst, cstr file_name) {
+		for (cstr c = file_name; *c; ++c) {
+			if (*c == '\\' || *c == '/') file_name = c + 1;
+		}
+		i32 length = 0;
+		while (file_name[length] && file_name[length] != '.' && length < dst.get_count() - 1) {
+			dst(length) = file_name[length];
+			length += 1;
+		}
+		dst(length) = 0;
+	}
+
+	static bool check_asset_name(Array<char, ASSET_NAME_SIZE>& name, cstr other) {
+		for (i32 i = 0; i < name.get_count(); ++i) {
+			if (name(i) != other[i]) return false;
+			if (!name(i)) return true;
+		}
+		return false;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "files.hpp"
+#include "globals.hpp"
+#include "platform.hpp"
+
+// пак битмапов, собранный заранее asset_packer. Пиксели уже в формате движка и используются прямо из отображения файла.
+// Игра просит битмап по Asset_Id и сразу получает ответ, загрузка идёт в фоне, пока битмап не готов, его не рисуем.
+// Без пака битмапы читаются из BMP в кэш с бюджетом, при нехватке места выгружаются давно не рисованные
+namespace Assets {
+	static constexpr u32 PACK_FILE_MAGIC = 'H' | 'M' << 8 | 'A' << 16 | 'P' << 24;
+	static constexpr u32 PACK_FILE_VERSION = 1;
+	static constexpr i64 PACK_FILE_PIXELS_ALIGN = 64;
+	static constexpr i32 ASSET_NAME_SIZE = 32;
+	static constexpr i32 ASSET_FILE_NAME_SIZE = 64;
+	static constexpr i32 LOADER_MAX_JOBS = 16;
+	static constexpr i64 CACHE_DEFAULT_SIZE = 64_MB;
+	static constexpr i64 CACHE_BLOCK_ALIGN = 64;
+
+	// Asset_Id и есть хендл ассета, имена в ASSET_NAMES в том же порядке
+	namespace Asset_Id {
+		enum Type {
+			Background,
+			Hero_Front_Head,
+			Hero_Front_Cape,
+			Hero_Front_Torso,
+			Hero_Back_Head,
+			Hero_Back_Cape,
+			Hero_Back_Torso,
+			Hero_Left_Head,
+			Hero_Left_Cape,
+			Hero_Left_Torso,
+			Hero_Right_Head,
+			Hero_Right_Cape,
+			Hero_Right_Torso,
+			Count
+		};
+	}
+
+	static constexpr cstr ASSET_NAMES[Asset_Id::Count] = {
+		"test_background",
+		"test_hero_front_head",
+		"test_hero_front_cape",
+		"test_hero_front_torso",
+		"test_hero_back_head",
+		"test_hero_back_cape",
+		"test_hero_back_torso",
+		"test_hero_left_head",
+		"test_hero_left_cape",
+		"test_hero_left_torso",
+		"test_hero_right_head",
+		"test_hero_right_cape",
+		"test_hero_right_torso",
+	};
+
+	// заголовок, индекс, пиксели каждого битмапа с границы PACK_FILE_PIXELS_ALIGN
+	struct Pack_File_Header {
+		u32 magic;
+		u32 version;
+		i64 index_offset;
+		i64 entries_count;
+	};
+
+	struct Pack_Entry {
+		Array<char, ASSET_NAME_SIZE> name; // имя файла без папки и расширения
+		v2<i32> count;
+		i64 pixels_offset;
+	};
+
+	struct Pack {
+		slice<u8> file;
+		slice<Pack_Entry> entries;
+	};
+
+	enum struct Asset_State {
+		Unloaded,
+		Loading,
+		Loaded,
+		Failed, // повторно не грузим
+	};
+
+	struct Asset {
+		Asset_State state;
+		slice2<u32> bitmap; // только в Loaded
+		u8* memory;         // кусок кэша в Loading и Loaded, только у BMP без пака
+		u32 last_used_frame; // в этом кадре ассет не выгружается
+	};
+
+	// заголовок перед каждым куском, куски идут подряд и покрывают весь кэш
+	struct Cache_Block {
+		Cache_Block* prev; // соседи по адресу
+		Cache_Block* next;
+		i64 size;          // без заголовка, кратен CACHE_BLOCK_ALIGN
+		bool is_used;
+	};
+
+	static constexpr i64 CACHE_BLOCK_HEADER_SIZE = (size_of(Cache_Block) + CACHE_BLOCK_ALIGN - 1) / CACHE_BLOCK_ALIGN * CACHE_BLOCK_ALIGN;
+
+	// игра только прибавляет, платформа читает для отчёта
+	struct Cache_Stats {
+		i64 hits;   // get_bitmap отдал готовый битмап
+		i64 misses; // битмап ещё грузится или выгружен
+		i64 evictions;
+		i64 used_size;
+		i64 size;
+	};
+
+	struct Cache {
+		Cache_Block* first;
+		Cache_Stats stats;
+	};
+
+	struct Loader;
+
+	struct Load_Job {
+		Loader* loader;
+		Asset_Id::Type id;
+		slice<u8> memory; // кусок кэша, BMP без пака читается сюда и переводится на месте. Пустой, пока не известен размер
+		slice2<u32> pack_bitmap;
+		Array<char, ASSET_FILE_NAME_SIZE> file_name;
+		i64 file_size;
+		slice2<u32> bitmap;
+		bool is_used;
+		bool ok;
+		volatile bool is_done;
+	};
+
+	// функции платформы и очередь заполняет вызывающий
+	struct Loader {
+		Pack pack;
+		Cache cache;
+		Array<Asset, Asset_Id::Count> assets;
+		Array<Load_Job, LOADER_MAX_JOBS> jobs;
+		u32 frame_index;
+		Game::Work_Queue* queue; // nullptr = грузим сразу на главном потоке
+		Game::Add_Work* add_work;
+		Game::Get_File_Size* get_file_size;
+		Game::Read_File* read_file;
+	};
+
+	#pragma pack(push, 1)
+	struct Bmp_Header {
+		// WINBMPFILEHEADER
+		u16 file_type;        /* File type, always 4D42h ("BM") */
+		u32 file_size;        /* Size of the file in bytes */
+		u16 reserved1;        /* Always 0 */
+		u16 reserved2;        /* Always 0 */
+		u32 bitmap_offset;    /* Starting position of image data in bytes */
+
+		// WIN3XBITMAPHEADER
+		u32 size;             /* Size of this header in bytes */
+		i32 width;            /* Image width in pixels */
+		i32 height;           /* Image height in pixels */
+		u16 planes;           /* Number of color planes */
+		u16 bits_per_pixel;   /* Number of bits per pixel */
+		u32 compression;      /* Compression methods used */
+		u32 size_of_bitmap;   /* Size of bitmap in bytes */
+		i32 horz_resolution;  /* Horizontal resolution in pixels per meter */
+		i32 vert_resolution;  /* Vertical resolution in pixels per meter */
+		u32 colors_used;      /* Number of colors in the image */
+		u32 colors_important; /* Minimum number of important colors */
+
+		// WINNTBITFIELDSMASKS
+		u32 red_mask;         /* Mask identifying bits of red component */
+		u32 green_mask;       /* Mask identifying bits of green component */
+		u32 blue_mask;        /* Mask identifying bits of blue component */
+	};
+	#pragma pack(pop)
+
+	static bool load_pack(Pack& pack, slice<u8> file);
+	static slice2<u32> find_bitmap(Pack& pack, cstr name);
+
+	static slice2<u32> get_bitmap(Game::Thread& thread, Loader& loader, Asset_Id::Type id);
+	static void request_asset(Game::Thread& thread, Loader& loader, Asset_Id::Type id);
+	static void update_loader(Game::Thread& thread, Loader& loader);
+	static Load_Job* get_free_load_job(Loader& loader);
+	static void start_load_job(Game::Thread& thread, Loader& loader, Load_Job& job, Asset_Id::Type id);
+	static void finish_load_job(Game::Thread& thread, Loader& loader, Load_Job& job);
+	static void do_load_job(Game::Thread& thread, void* data);
+	static u8* alloc_asset_memory(Loader& loader, i64 size);
+
+	static void init_cache(Cache& cache, slice<u8> memory);
+	static u8* alloc_cache_block(Cache& cache, i64 size);
+	static void free_cache_block(Cache& cache, u8* memory);
+	static void merge_cache_blocks(Cache_Block& first, Cache_Block& second);
+
+	static slice2<u32> convert_bmp(slice<u8> file);
+	static void copy_asset_name(Array<char, ASSET_NAME_SIZE>& dst, cstr file_name);
+	static bool check_asset_name(Array<char, ASSET_NAME_SIZE>& name, cstr other);
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#include "collision.hpp"
+
+namespace Collision {
+	// box_dim и delta в единицах мира, pos это центр прямоугольника
+	static void move_and_slide(Tiles::Map& map, Tiles::Position& pos, v2<f32>& velocity, v2<f32> box_dim, v2<f32> delta) {
+		for (i32 iteration = 0; iteration < MAX_ITERATIONS; ++iteration) {
+			if (!delta.x && !delta.y) break;
+
+			// проверяем только тайлы, которые задевает прямоугольник на всём пути
+			v2<f32> sweep_min = hm::min(delta, v2<f32>{ 0, 0 }) - box_dim / 2 + pos.tile_rel;
+			v2<f32> sweep_max = hm::max(delta, v2<f32>{ 0, 0 }) + box_dim / 2 + pos.tile_rel;
+			v2<i32> tile_min = pos.abs_xy + v2<i32>{ hm::floor(sweep_min.x / Tiles::TILE_DIM), hm::floor(sweep_min.y / Tiles::TILE_DIM) };
+			v2<i32> tile_max = pos.abs_xy + v2<i32>{ hm::floor(sweep_max.x / Tiles::TILE_DIM), hm::floor(sweep_max.y / Tiles::TILE_DIM) };
+
+			// стена тайла раздута на половину прямоугольника, дальше двигаем точку
+			v2<f32> wall_min = - (box_dim + v2<f32>{ Tiles::TILE_DIM, Tiles::TILE_DIM }) / 2;
+			v2<f32> wall_max =   (box_dim + v2<f32>{ Tiles::TILE_DIM, Tiles::TILE_DIM }) / 2;
+
+			f32 t_min = 1.0f;
+			v2<f32> normal = {};
+			for (    i32 tile_y = tile_min.y; tile_y <= tile_max.y; ++tile_y) {
+				for (i32 tile_x = tile_min.x; tile_x <= tile_max.x; ++tile_x) {
+					if (Tiles::check_walkable(Tiles::get_tile(map, tile_x, tile_y, pos.abs_z))) continue;
+
+					v2<f32> tile_center = (cast<v2<f32>>(v2<i32>{ tile_x, tile_y } - pos.abs_xy) + v2<f32>{ 0.5f, 0.5f }) * Tiles::TILE_DIM;
+					v2<f32> rel = pos.tile_rel - tile_center;
+
+					if (test_wall(wall_min.x, -1, rel.x, rel.y, delta.x, delta.y, wall_min.y, wall_max.y, t_min)) normal = { -1,  0 };
+					if (test_wall(wall_max.x,  1, rel.x, rel.y, delta.x, delta.y, wall_min.y, wall_max.y, t_min)) normal = {  1,  0 };
+					if (test_wall(wall_min.y, -1, rel.y, rel.x, delta.y, delta.x, wall_min.x, wall_max.x, t_min)) normal = {  0, -1 };
+					if (test_wall(wall_max.y,  1, rel.y, rel.x, delta.y, delta.x, wall_min.x, wall_max.x, t_min)) normal = {  0,  1 };
+				}
+			}
+
+			pos.tile_rel_add(delta * t_min);
+			if (!normal.x && !normal.y) break;
+
+			velocity -= normal * dot(velocity, normal);
+			delta = delta * (1.0f - t_min);
+			delta -= normal * dot(delta, normal);
+		}
+	}
+
+	// стена это отрезок x = wall_x, y в [min_y, max_y], normal_x смотрит наружу. Сдвигаемся только до неё, с небольшим зазором
+	static bool test_wall(f32 wall_x, f32 normal_x, f32 rel_x, f32 rel_y, f32 delta_x, f32 delta_y, f32 min_y, f32 max_y, f32& t_min) {
+		if (delta_x * normal_x >= 0) return false; // от стены или вдоль неё
+
+		f32 t_result = (wall_x - rel_x) / delta_x;
+		// из-за округления можно оказаться чуть за стеной, тогда упираемся сразу, а не проходим её насквозь
+		if (t_result < 0 && (rel_x - wall_x) * normal_x > -PENETRATION_EPSILON) t_result = 0;
+		f32 y = rel_y + t_result * delta_y;
+		if (t_result < 0 || t_result >= t_min || y < min_y || y > max_y) return false;
+
+		t_min = hm::max(0.0f, t_result - T_EPSILON);
+		return true;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "globals.hpp"
+#include "tiles.hpp"
+
+// непрерывная коллизия прямоугольника с тайлами: ищем время удара о ближайшую стену и скользим вдоль неё
+namespace Collision {
+	static constexpr i32 MAX_ITERATIONS = 4;
+	static constexpr f32 T_EPSILON = 0.001f;
+	static constexpr f32 PENETRATION_EPSILON = 0.01f;
+
+	static void move_and_slide(Tiles::Map& map, Tiles::Position& pos, v2<f32>& velocity, v2<f32> box_dim, v2<f32> delta);
+	static bool test_wall(f32 wall_x, f32 normal_x, f32 rel_x, f32 rel_y, f32 delta_x, f32 delta_y, f32 min_y, f32 max_y, f32& t_min);
+}
\ No newline at end of file
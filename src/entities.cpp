@@ -0,0 +1,173 @@
+#include "entities.hpp"
+
+namespace Entities {
+	static void init_storage(Arena& world_arena, Tiles::Map& map, Storage& storage) {
+		storage.types.count          = MAX_ENTITIES;
+		storage.positions.count      = MAX_ENTITIES;
+		storage.prev_positions.count = MAX_ENTITIES;
+		storage.velocities.count     = MAX_ENTITIES;
+		storage.dims.count           = MAX_ENTITIES;
+		storage.facings.count        = MAX_ENTITIES;
+		storage.chunk_next.count     = MAX_ENTITIES;
+		storage.chunk_prev.count     = MAX_ENTITIES;
+		storage.chunk_keys.count     = MAX_ENTITIES;
+		storage.types.ptr          = world_arena.push<Type>(storage.types.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.positions.ptr      = world_arena.push<Tiles::Position>(storage.positions.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.prev_positions.ptr = world_arena.push<Tiles::Position>(storage.prev_positions.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.velocities.ptr     = world_arena.push<v2<f32>>(storage.velocities.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.dims.ptr           = world_arena.push<v2<f32>>(storage.dims.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.facings.ptr        = world_arena.push<i32>(storage.facings.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.chunk_next.ptr     = world_arena.push<i32>(storage.chunk_next.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.chunk_prev.ptr     = world_arena.push<i32>(storage.chunk_prev.get_size(), CACHE_LINE_SIZE, "entities");
+		storage.chunk_keys.ptr     = world_arena.push<Tiles::Chunk_Lookup_Key>(storage.chunk_keys.get_size(), CACHE_LINE_SIZE, "entities");
+
+		auto& chunk_first = storage.chunk_first;
+		chunk_first.count_x = map.chunks.count_x;
+		chunk_first.count_y = map.chunks.count_y;
+		chunk_first.count_z = map.chunks.count_z;
+		chunk_first.ptr = world_arena.push<i32>(chunk_first.get_size(), alignof(i32), "entities");
+		for (auto& first : chunk_first) first = NO_ENTITY;
+		storage.first_free = NO_ENTITY;
+	}
+
+	// сначала занимаем индексы удалённых, так count растёт только при нехватке
+	static i32 add_entity(Storage& storage, Type type, Tiles::Position& pos, v2<f32> dim) {
+		i32 index = storage.first_free;
+		if (index != NO_ENTITY) {
+			storage.first_free = storage.chunk_next(index);
+		} else if (storage.count < MAX_ENTITIES) {
+			index = storage.count;
+			storage.count += 1;
+		} else {
+			assert(false && "storage.count < MAX_ENTITIES");
+			return NO_ENTITY;
+		}
+
+		storage.types(index)          = type;
+		storage.positions(index)      = pos;
+		storage.prev_positions(index) = pos;
+		storage.velocities(index)     = {};
+		storage.dims(index)           = dim;
+		storage.facings(index)        = 0;
+		link_to_chunk(storage, index);
+		return index;
+	}
+
+	// индекс освобождается сразу, поэтому удалять можно только вне begin_sim/end_sim
+	static void remove_entity(Storage& storage, i32 index) {
+		assert_or_return_void(index >= 0 && index < storage.count && storage.types(index) != Type::None);
+		unlink_from_chunk(storage, index);
+		storage.types(index) = Type::None;
+		storage.chunk_next(index) = storage.first_free;
+		storage.first_free = index;
+	}
+
+	// берём сущности только из чанков, которые задевает круг, и только с этажа центра
+	static Sim_Region begin_sim(Arena& scratch_arena, Storage& storage, Tiles::Position& center, f32 radius) {
+		Sim_Region region = {};
+		region.center = center;
+		region.radius = radius;
+		region.storage_indices.ptr = scratch_arena.push<i32>(storage.count * size_of(i32));
+
+		i32 radius_tiles = hm::ceil(radius / Tiles::TILE_DIM);
+		auto key_min = Tiles::get_chunk_lookup_key(hm::max(center.abs_xy.x - radius_tiles, 0), hm::max(center.abs_xy.y - radius_tiles, 0), center.abs_z);
+		auto key_max = Tiles::get_chunk_lookup_key(center.abs_xy.x + radius_tiles, center.abs_xy.y + radius_tiles, center.abs_z);
+		key_max.x = hm::min(key_max.x, storage.chunk_first.count_x - 1);
+		key_max.y = hm::min(key_max.y, storage.chunk_first.count_y - 1);
+
+		for (    i32 key_y = key_min.y; key_y <= key_max.y; ++key_y) {
+			for (i32 key_x = key_min.x; key_x <= key_max.x; ++key_x) {
+				for (i32 index = storage.chunk_first(key_x, key_y, center.abs_z); index != NO_ENTITY; index = storage.chunk_next(index)) {
+					v2<f32> diff = Tiles::subtract_positions(storage.positions(index), center);
+					if (dot(diff, diff) > radius * radius) continue;
+
+					region.storage_indices.ptr[region.storage_indices.count] = index;
+					region.storage_indices.count += 1;
+				}
+			}
+		}
+
+		region.count = cast<i32>(region.storage_indices.count);
+		region.types.count          = region.count;
+		region.positions.count      = region.count;
+		region.prev_positions.count = region.count;
+		region.velocities.count     = region.count;
+		region.dims.count           = region.count;
+		region.facings.count        = region.count;
+		region.types.ptr          = scratch_arena.push<Type>(region.types.get_size(), CACHE_LINE_SIZE);
+		region.positions.ptr      = scratch_arena.push<Tiles::Position>(region.positions.get_size(), CACHE_LINE_SIZE);
+		region.prev_positions.ptr = scratch_arena.push<Tiles::Position>(region.prev_positions.get_size(), CACHE_LINE_SIZE);
+		region.velocities.ptr     = scratch_arena.push<v2<f32>>(region.velocities.get_size(), CACHE_LINE_SIZE);
+		region.dims.ptr           = scratch_arena.push<v2<f32>>(region.dims.get_size(), CACHE_LINE_SIZE);
+		region.facings.ptr        = scratch_arena.push<i32>(region.facings.get_size(), CACHE_LINE_SIZE);
+
+		for (i32 sim_index = 0; sim_index < region.count; ++sim_index) {
+			i32 index = region.storage_indices(sim_index);
+			region.types(sim_index)          = storage.types(index);
+			region.positions(sim_index)      = storage.positions(index);
+			region.prev_positions(sim_index) = storage.prev_positions(index);
+			region.velocities(sim_index)     = storage.velocities(index);
+			region.dims(sim_index)           = storage.dims(index);
+			region.facings(sim_index)        = storage.facings(index);
+		}
+		return region;
+	}
+
+	static void end_sim(Storage& storage, Sim_Region& region) {
+		for (i32 sim_index = 0; sim_index < region.count; ++sim_index) {
+			i32 index = region.storage_indices(sim_index);
+			storage.prev_positions(index) = storage.positions(index);
+			storage.positions(index)      = region.positions(sim_index);
+			storage.velocities(index)     = region.velocities(sim_index);
+			storage.facings(index)        = region.facings(sim_index);
+
+			auto& pos = storage.positions(index);
+			auto key = Tiles::get_chunk_lookup_key(pos.abs_xy.x, pos.abs_xy.y, pos.abs_z);
+			auto& old_key = storage.chunk_keys(index);
+			if (key.x != old_key.x || key.y != old_key.y || key.z != old_key.z) {
+				unlink_from_chunk(storage, index);
+				link_to_chunk(storage, index);
+			}
+		}
+	}
+
+	// alpha это доля следующего тика, прошедшая после последнего. Переход по лестнице не сглаживаем
+	static Tiles::Position get_interpolated_position(Sim_Region& region, i32 sim_index, f32 alpha) {
+		auto& prev = region.prev_positions(sim_index);
+		auto& pos  = region.positions(sim_index);
+		if (prev.abs_z != pos.abs_z) return pos;
+
+		auto result = prev;
+		result.tile_rel_add(Tiles::subtract_positions(pos, prev) * alpha);
+		return result;
+	}
+
+	static i32 find_sim_index(Sim_Region& region, i32 storage_index) {
+		for (i32 sim_index = 0; sim_index < region.count; ++sim_index) {
+			if (region.storage_indices(sim_index) == storage_index) return sim_index;
+		}
+		return NO_ENTITY;
+	}
+
+	static void link_to_chunk(Storage& storage, i32 index) {
+		auto& pos = storage.positions(index);
+		auto key = Tiles::get_chunk_lookup_key(pos.abs_xy.x, pos.abs_xy.y, pos.abs_z);
+		auto& first = storage.chunk_first(key.x, key.y, key.z);
+
+		storage.chunk_keys(index) = key;
+		storage.chunk_prev(index) = NO_ENTITY;
+		storage.chunk_next(index) = first;
+		if (first != NO_ENTITY) storage.chunk_prev(first) = index;
+		first = index;
+	}
+
+	static void unlink_from_chunk(Storage& storage, i32 index) {
+		auto& key = storage.chunk_keys(index);
+		i32 prev = storage.chunk_prev(index);
+		i32 next = storage.chunk_next(index);
+
+		if (prev != NO_ENTITY) storage.chunk_next(prev) = next;
+		else                   storage.chunk_first(key.x, key.y, key.z) = next;
+		if (next != NO_ENTITY) storage.chunk_prev(next) = prev;
+	}
+}
\ No newline at end of file
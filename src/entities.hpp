@@ -0,0 +1,59 @@
+#pragma once
+
+#include "globals.hpp"
+#include "tiles.hpp"
+
+// сущности хранятся массивами по полям (structure of arrays), индекс сущности общий для всех массивов.
+// Каждый кадр в область симуляции копируются только сущности рядом с камерой
+namespace Entities {
+	static constexpr i32 MAX_ENTITIES = 1 << 16;
+	static constexpr i32 NO_ENTITY = -1;
+
+	enum struct Type : u8 {
+		None,
+		Hero,
+		Familiar,
+	};
+
+	struct Storage {
+		i32 count;
+		i32 first_free; // удалённые сущности, дальше по chunk_next. NO_ENTITY если их нет
+		slice<Type> types;
+		slice<Tiles::Position> positions;
+		slice<Tiles::Position> prev_positions; // до последнего тика, для интерполяции при отрисовке
+		slice<v2<f32>> velocities;
+		slice<v2<f32>> dims;
+		slice<i32> facings;
+
+		// двусвязные списки сущностей по чанкам, чтобы собирать область без обхода всего мира
+		slice3<i32> chunk_first;
+		slice<i32> chunk_next;
+		slice<i32> chunk_prev;
+		slice<Tiles::Chunk_Lookup_Key> chunk_keys;
+	};
+
+	// плотная рабочая копия сущностей рядом с центром, живёт до end_sim. Сущности одного чанка идут подряд
+	struct Sim_Region {
+		Tiles::Position center;
+		f32 radius;
+		i32 count;
+		slice<i32> storage_indices;
+		slice<Type> types;
+		slice<Tiles::Position> positions;
+		slice<Tiles::Position> prev_positions;
+		slice<v2<f32>> velocities;
+		slice<v2<f32>> dims;
+		slice<i32> facings;
+	};
+
+	static void init_storage(Arena& world_arena, Tiles::Map& map, Storage& storage);
+	static i32 add_entity(Storage& storage, Type type, Tiles::Position& pos, v2<f32> dim);
+	static void remove_entity(Storage& storage, i32 index);
+	static Sim_Region begin_sim(Arena& scratch_arena, Storage& storage, Tiles::Position& center, f32 radius);
+	static void end_sim(Storage& storage, Sim_Region& region);
+	static Tiles::Position get_interpolated_position(Sim_Region& region, i32 sim_index, f32 alpha);
+	static i32 find_sim_index(Sim_Region& region, i32 storage_index);
+
+	static void link_to_chunk(Storage& storage, i32 index);
+	static void unlink_from_chunk(Storage& storage, i32 index);
+}
\ No newline at end of file
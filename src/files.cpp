@@ -0,0 +1,71 @@
+#include "files.hpp"
+
+namespace Files {
+	static slice<u8> read_entire_file(Game::Thread& thread, Game::Get_File_Size* get_file_size, Game::Read_File* read_file, Arena& arena, cstr file_name) {
+		i64 file_size = get_file_size(thread, file_name);
+		if (file_size <= 0) return {};
+
+		u64 padding = (0 - cast<u64>(arena.ptr + arena.used)) & (CACHE_LINE_SIZE - 1);
+		if (file_size > arena.size - arena.used - cast<i64>(padding)) return {}; // файл вырос после того, как под него выделили место
+
+		auto temp = arena.begin_temp();
+		slice<u8> file = { arena.push<u8>(file_size, CACHE_LINE_SIZE), file_size };
+		if (!read_file(thread, file_name, file)) {
+			arena.end_temp(temp);
+			return {};
+		}
+		return file;
+	}
+
+	// false если файла нет
+	static bool open_stream(Game::Thread& thread, Stream& stream, Arena& arena, cstr file_name, i64 ring_size) {
+		assert_or_return(ring_size >= 2 * STREAM_BLOCK_SIZE && ring_size % STREAM_BLOCK_SIZE == 0);
+		assert_or_return(!stream.file.handle);
+
+		stream.file_size   = stream.get_file_size(thread, file_name);
+		stream.file_offset = 0;
+		stream.read_offset = 0;
+		stream.is_failed   = false;
+		if (stream.file_size < 0) return false;
+
+		stream.file = stream.open_file_for_reading(thread, file_name);
+		if (!stream.file.handle) return false;
+
+		if (stream.ring.count != ring_size) stream.ring = { arena.push<u8>(ring_size, PAGE_SIZE), ring_size };
+		assert_or_return(stream.ring.ptr, stream.close_file(thread, stream.file));
+		return true;
+	}
+
+	// пустой slice в конце файла или после ошибки чтения
+	static slice<u8> read_stream_block(Game::Thread& thread, Stream& stream) {
+		if (!stream.file.handle || stream.is_failed) return {};
+		if (stream.read_offset == stream.file_offset) fill_stream(thread, stream);
+		if (stream.read_offset == stream.file_offset) return {};
+
+		i64 block_size = hm::min(STREAM_BLOCK_SIZE, stream.file_offset - stream.read_offset);
+		slice<u8> block = { stream.ring.ptr + stream.read_offset % stream.ring.count, block_size };
+		stream.read_offset += block_size;
+		return block;
+	}
+
+	// кольцо остаётся за потоком, следующий open_stream того же размера возьмёт его снова
+	static void close_stream(Game::Thread& thread, Stream& stream) {
+		if (stream.file.handle) stream.close_file(thread, stream.file);
+	}
+
+	// дочитывает в кольцо всё, кроме места последнего отданного блока. Блоки не пересекают край кольца,
+	// потому что размер кольца кратен блоку
+	static void fill_stream(Game::Thread& thread, Stream& stream) {
+		i64 keep_offset = hm::max<i64>(stream.read_offset - STREAM_BLOCK_SIZE, 0);
+		while (stream.file_offset < stream.file_size &&
+		       stream.file_offset - keep_offset < stream.ring.count) {
+			i64 block_size = hm::min(STREAM_BLOCK_SIZE, stream.file_size - stream.file_offset);
+			slice<u8> block = { stream.ring.ptr + stream.file_offset % stream.ring.count, block_size };
+			if (!stream.read_file_block(thread, stream.file, stream.file_offset, block)) {
+				stream.is_failed = true;
+				return;
+			}
+			stream.file_offset += block_size;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "globals.hpp"
+#include "platform.hpp"
+
+// чтение файлов без выделений: целиком в арену вызывающего или потоком блоков через кольцевой буфер
+namespace Files {
+	static constexpr i64 STREAM_BLOCK_SIZE = 64_KB;
+
+	// кольцо дочитывается с диска сразу на весь свободный размер, когда отданы все блоки.
+	// Блок из read_stream_block остаётся целым и после следующего вызова. Функции платформы заполняет вызывающий
+	struct Stream {
+		Game::File file; // handle nullptr если файла нет
+		i64 file_size;
+		i64 file_offset; // сколько файла уже лежит в кольце
+		i64 read_offset; // сколько уже отдано, оба смещения в кольце берутся по модулю его размера
+		slice<u8> ring;
+		bool is_failed;
+		Game::Open_File_For_Reading* open_file_for_reading;
+		Game::Get_File_Size* get_file_size;
+		Game::Read_File_Block* read_file_block;
+		Game::Close_File* close_file;
+	};
+
+	// размер узнаём заранее и кладём ровно столько. Пустой slice если файла нет, он не влезает в арену
+	// или чтение не удалось, арена тогда не меняется
+	static slice<u8> read_entire_file(Game::Thread& thread, Game::Get_File_Size* get_file_size, Game::Read_File* read_file, Arena& arena, cstr file_name);
+
+	// ring_size кратен STREAM_BLOCK_SIZE и не меньше двух блоков, кольцо берётся из арены
+	static bool open_stream(Game::Thread& thread, Stream& stream, Arena& arena, cstr file_name, i64 ring_size);
+	static slice<u8> read_stream_block(Game::Thread& thread, Stream& stream);
+	static void close_stream(Game::Thread& thread, Stream& stream);
+
+	static void fill_stream(Game::Thread& thread, Stream& stream);
+}
\ No newline at end of file
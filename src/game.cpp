@@ -1,6 +1,13 @@
 #include "game.hpp"
 #include "intrinsics.hpp"
+#include "assets.cpp"
+#include "files.cpp"
 #include "tiles.cpp"
+#include "collision.cpp"
+#include "entities.cpp"
+#include "paths.cpp"
+#include "rays.cpp"
+#include "spatial.cpp"
 
 namespace Game {
 	extern "C" void get_sound_samples(Thread& thread, Memory& memory, Sound& sound) {
@@ -21,90 +28,93 @@ namespace Game {
 		}
 	}
 
-	extern "C" void update_and_render(Thread& thread, Input& input, Memory& memory, slice2<u32> screen) {
-		assert(input.frame_dt > 0);
-		if (!memory.is_initialized) {
-			init_memory(thread, memory);
+	// get_tile по всем тайлам мира строка за строкой
+	extern "C" u64 scan_world(Thread& thread, Memory& memory) {
+		assert_or_return(memory.is_initialized);
+		auto& tile_map = get_game_state(memory).world.tile_map;
+
+		u64 sum = 0;
+		for (        i32 abs_z = 0; abs_z < tile_map.chunks.count_z; ++abs_z) {
+			for (    i32 abs_y = 0; abs_y < tile_map.chunks.count_y * Tiles::CHUNK_DIM_TILES; ++abs_y) {
+				for (i32 abs_x = 0; abs_x < tile_map.chunks.count_x * Tiles::CHUNK_DIM_TILES; ++abs_x) {
+					sum += cast<u64>(Tiles::get_tile(tile_map, abs_x, abs_y, abs_z));
+				}
+			}
 		}
+		return sum;
+	}
 
+	extern "C" void release_world(Thread& thread, Memory& memory) {
+		if (!memory.is_initialized) return;
 		auto& game_state = get_game_state(memory);
-		auto& hero_dir   = game_state.hero_dir;
-		auto& hero_pos   = game_state.hero_pos;
-		auto& d_hero_pos = game_state.d_hero_pos;
-		auto& camera_pos = game_state.camera_pos;
-		auto& tile_map   = game_state.world.tile_map;
-		auto& frame_dt   = input.frame_dt;
 
-		auto new_hero_pos = hero_pos;
-		for (auto& controller : input.controllers) {
-			v2<f32> dd_hero_pos = {};
-			f32 dd_hero_amp = controller.action_down.is_pressed ? 50.0f : 10.0f;
+		if (game_state.world.file.ptr)       memory.unmap_file(thread, game_state.world.file);
+		if (game_state.assets.pack.file.ptr) memory.unmap_file(thread, game_state.assets.pack.file);
+		if (game_state.world.pager.file.handle) memory.close_file(thread, game_state.world.pager.file);
+		game_state.assets.pack = {};
+		memory.is_initialized = false;
+	}
 
-			if (controller.move_left.is_pressed) {
-				hero_dir = Hero_Direction::Left;
-				dd_hero_pos.x -= dd_hero_amp;
-			}
-			if (controller.move_right.is_pressed) {
-				hero_dir = Hero_Direction::Right;
-				dd_hero_pos.x += dd_hero_amp;
-			}
-			if (controller.move_up.is_pressed) {
-				hero_dir = Hero_Direction::Back;
-				dd_hero_pos.y += dd_hero_amp;
-			}
-			if (controller.move_down.is_pressed) {
-				hero_dir = Hero_Direction::Front;
-				dd_hero_pos.y -= dd_hero_amp;
-			}
-			if (dd_hero_pos.x && dd_hero_pos.y) {
-				dd_hero_pos /= SQRT_2;
-			}
-			dd_hero_pos -= 2.0f * d_hero_pos;
+	extern "C" void simulate(Thread& thread, Input& input, Memory& memory) {
+		assert(input.frame_dt > 0);
+		if (!memory.is_initialized) {
+			init_memory(thread, memory);
+		}
 
-			new_hero_pos.tile_rel_add(dd_hero_pos / 2 * frame_dt * frame_dt + d_hero_pos * frame_dt);
-			d_hero_pos += dd_hero_pos * frame_dt;
+		auto& game_state   = get_game_state(memory);
+		auto& entities     = game_state.world.entities;
+		auto& camera_pos   = game_state.camera_pos;
+		auto& tile_map     = game_state.world.tile_map;
+		auto& frame_dt     = input.frame_dt;
+		auto& phase_cycles = memory.phase_cycles;
+
+		auto& scratch_arena = game_state.frame_arena.begin_frame();
+
+		// генератор и пейджер смотрят на камеру прошлого кадра
+		u64 start_cycles = hm::read_cycle_counter();
+		update_world_generator(thread, memory, game_state.world, scratch_arena, camera_pos);
+		Tiles::update_pager(thread, game_state.world.arena, tile_map, game_state.world.pager, camera_pos, entities.velocities(game_state.hero_index));
+		u64 world_cycles = hm::read_cycle_counter();
+		phase_cycles(Phase::World) += world_cycles - start_cycles;
+
+		// симуляция идёт фиксированными тиками независимо от частоты кадров, за кадр бывает ноль или несколько тиков
+		auto& sim_time_accumulator = game_state.sim_time_accumulator;
+		sim_time_accumulator = hm::min(sim_time_accumulator + frame_dt, SIM_MAX_TICKS_PER_FRAME * SIM_TICK_DT);
+		while (sim_time_accumulator >= SIM_TICK_DT) {
+			simulate_tick(thread, input, memory, game_state);
+			sim_time_accumulator -= SIM_TICK_DT;
 		}
+		u64 sim_cycles = hm::read_cycle_counter();
+		phase_cycles(Phase::Sim) += sim_cycles - world_cycles;
 
-		f32 hero_width  = 1.0f;
-		auto new_hero_pos_left = new_hero_pos;
-		new_hero_pos_left.tile_rel_add({ - hero_width / 2, 0 });
-		auto new_hero_pos_right = new_hero_pos;
-		new_hero_pos_left.tile_rel_add({   hero_width / 2, 0 });
+		Paths::update_pathfinder(game_state.world.arena, scratch_arena, tile_map, game_state.world.pathfinder);
+		update_companion(game_state, frame_dt);
+		phase_cycles(Phase::Pathfinder) += hm::read_cycle_counter() - sim_cycles;
+	}
 
-		result<Tiles::Position> collision_pos = {};
-		if (!Tiles::check_walkable_tile(tile_map, new_hero_pos_left))  collision_pos = { true, new_hero_pos_left };
-		if (!Tiles::check_walkable_tile(tile_map, new_hero_pos))       collision_pos = { true, new_hero_pos };
-		if (!Tiles::check_walkable_tile(tile_map, new_hero_pos_right)) collision_pos = { true, new_hero_pos_right };
+	extern "C" void render(Thread& thread, Memory& memory, slice2<u32> screen) {
+		assert_or_return_void(memory.is_initialized && !memory.is_headless);
+		u64 start_cycles = hm::read_cycle_counter();
 
-		if (collision_pos.ok) {
-			v2<i32> hero_xy = hero_pos.abs_xy;
-			v2<i32> collided_xy = collision_pos.value.abs_xy;
-			v2<f32> norm_vec = { hm::sign<f32>(hero_xy.x - collided_xy.x), hm::sign<f32>(hero_xy.y - collided_xy.y) };
-			if (norm_vec.x && norm_vec.y) norm_vec /= SQRT_2;
-			d_hero_pos -= norm_vec * dot(d_hero_pos, norm_vec);
-		} else {
-			if (!Tiles::check_same_tile(hero_pos, new_hero_pos)) {
-				auto new_tile = Tiles::get_tile(tile_map, new_hero_pos.abs_xy.x, new_hero_pos.abs_xy.y, new_hero_pos.abs_z);
-				if (new_tile == Tiles::Tile::Stairs_Up)   new_hero_pos.abs_z += 1;
-				if (new_tile == Tiles::Tile::Stairs_Down) new_hero_pos.abs_z -= 1;
-			}
-			hero_pos = new_hero_pos;
-			camera_pos.abs_z = hero_pos.abs_z;
+		auto& game_state = get_game_state(memory);
+		auto& entities   = game_state.world.entities;
+		auto& camera_pos = game_state.camera_pos;
+		auto& tile_map   = game_state.world.tile_map;
+		auto& assets     = game_state.assets;
+		f32 sim_alpha = game_state.sim_time_accumulator / SIM_TICK_DT;
 
-			for (i32 axis = 0; axis < 2; ++axis) {
-				i32 abs_diff = hero_pos.abs_xy(axis) - camera_pos.abs_xy(axis);
-				if (hm::abs(abs_diff) > SCENE_DIM_TILES(axis) / 2) {
-					camera_pos.abs_xy(axis) += SCENE_DIM_TILES(axis) * hm::sign<i32>(abs_diff);
-				}
-			}
-		}
+		Assets::update_loader(thread, assets);
+
+		auto& scratch_arena = game_state.frame_arena.get_current();
+		auto& hero_pos = entities.positions(game_state.hero_index);
+		auto render_region = Entities::begin_sim(scratch_arena, entities, camera_pos, SIM_REGION_RADIUS); // только для чтения, end_sim не вызываем
 
 		draw_rectangle(
 			screen, Color{ 1.0f, 0.0f, 1.0f },
 			v2<f32>{0.0f, 0.0f},
 			cast<v2<f32>>(SCENES_PER_SCREEN * SCENE_DIM_TILES) * Tiles::TILE_DIM
 		);		
-		draw_pixels(screen, game_state.background_bitmap, v2<f32>{0, 0});
+		draw_pixels(screen, Assets::get_bitmap(thread, assets, Assets::Asset_Id::Background), v2<f32>{0, 0});
 
 		v2<i32> half_screen_tiles = SCENES_PER_SCREEN * SCENE_DIM_TILES / 2;
 		for (    i32 y = camera_pos.abs_xy.y - half_screen_tiles.y - 1; y <= camera_pos.abs_xy.y + half_screen_tiles.y + 1; ++y) {
@@ -119,6 +129,7 @@ namespace Game {
 					case Tiles::Tile::Wall:            color = { 1.0f, 1.0f, 1.0f };    break;
 					case Tiles::Tile::Stairs_Up:       color = { 0.25f, 0.25f, 0.25f }; break;
 					case Tiles::Tile::Stairs_Down:     color = { 0.25f, 0.25f, 0.25f }; break;
+					case Tiles::Tile::Not_Generated:   color = { 0.0f, 0.0f, 0.5f };    break;
 				}
 
 				if (xy == hero_pos.abs_xy) {
@@ -137,15 +148,41 @@ namespace Game {
 			}
 		}
 
-		v2<f32> hero_camera_diff = Tiles::subtract_positions(hero_pos, camera_pos);
-		v2<f32> hero_ground = hero_camera_diff;
-		hero_ground.y = Tiles::TILE_DIM - hero_ground.y;
-		hero_ground += cast<v2<f32>>(half_screen_tiles) * Tiles::TILE_DIM;
+		// рисуем между двумя последними тиками, на долю уже накопленного времени следующего
+		for (i32 sim_index = 0; sim_index < render_region.count; ++sim_index) {
+			auto pos = Entities::get_interpolated_position(render_region, sim_index, sim_alpha);
+			if (pos.abs_z != camera_pos.abs_z) continue;
+
+			v2<f32> ground = Tiles::subtract_positions(pos, camera_pos);
+			ground.y = Tiles::TILE_DIM - ground.y;
+			ground += cast<v2<f32>>(half_screen_tiles) * Tiles::TILE_DIM;
+
+			if (render_region.types(sim_index) == Entities::Type::Hero) {
+				auto& hero_bitmap = game_state.hero_bitmaps(render_region.facings(sim_index));
+				auto torso = Assets::get_bitmap(thread, assets, hero_bitmap.torso);
+				auto cape  = Assets::get_bitmap(thread, assets, hero_bitmap.cape);
+				auto head  = Assets::get_bitmap(thread, assets, hero_bitmap.head);
+				if (torso.ptr && cape.ptr && head.ptr) {
+					draw_pixels(screen, torso, ground, hero_bitmap.align);
+					draw_pixels(screen, cape,  ground, hero_bitmap.align);
+					draw_pixels(screen, head,  ground, hero_bitmap.align);
+					continue;
+				}
+				// пока битмапы героя грузятся, он рисуется прямоугольником, как остальные
+			}
+
+			v2<f32> half_dim = render_region.dims(sim_index) / 2;
+			draw_rectangle(screen, Color{ 1.0f, 0.5f, 0.0f }, ground - half_dim, ground + half_dim);
+		}
 
-		auto hero_bitmap = game_state.hero_bitmaps(game_state.hero_dir);
-		draw_pixels(screen, hero_bitmap.torso, hero_ground, hero_bitmap.align);
-		draw_pixels(screen, hero_bitmap.cape,  hero_ground, hero_bitmap.align);
-		draw_pixels(screen, hero_bitmap.head,  hero_ground, hero_bitmap.align);
+		auto& companion_pos = game_state.companion.pos;
+		if (companion_pos.abs_z == camera_pos.abs_z) {
+			v2<f32> ground = Tiles::subtract_positions(companion_pos, camera_pos);
+			ground.y = Tiles::TILE_DIM - ground.y;
+			ground += cast<v2<f32>>(half_screen_tiles) * Tiles::TILE_DIM;
+			draw_rectangle(screen, Color{ 0.0f, 0.75f, 1.0f }, ground - COMPANION_DIM / 2, ground + COMPANION_DIM / 2);
+		}
+		memory.phase_cycles(Phase::Render) += hm::read_cycle_counter() - start_cycles;
 	};
 
 	static void draw_rectangle(slice2<u32> dst, Color color, v2<f32> min_f32, v2<f32> max_f32) {
@@ -205,59 +242,145 @@ namespace Game {
 		}
 	}
 
-	static slice2<u32> load_bmp(Thread& thread, Read_File* read_file, cstr file_name) {
-		slice<u8> read_result = read_file(thread, file_name);
-		if (!read_result.ptr) return {};
-
-		auto& header = cast<Bmp_Header&>(*read_result.ptr);
-		assert(header.compression == 3);
-
-		slice2<u32> pixels = {};
-		pixels.count = { header.width, header.height };
-		pixels.ptr = cast<u32*>(read_result.ptr + header.bitmap_offset);
-		assert(pixels.get_size() == read_result.get_size() - header.bitmap_offset);
-
-		u32 alpha_mask = ~(header.red_mask | header.green_mask | header.blue_mask);
-		result<i32> alpha_shift = hm::find_set_bit_right(alpha_mask);
-		result<i32> red_shift   = hm::find_set_bit_right(header.red_mask);
-		result<i32> green_shift = hm::find_set_bit_right(header.green_mask);
-		result<i32> blue_shift  = hm::find_set_bit_right(header.blue_mask);
-		assert(alpha_shift.ok && red_shift.ok && green_shift.ok && blue_shift.ok);
-
-		for (u32& pixel : pixels) {
-			pixel = ((pixel & alpha_mask)        >> alpha_shift.value << 24) |
-			        ((pixel & header.red_mask)   >> red_shift.value   << 16) |
-					((pixel & header.green_mask) >> green_shift.value << 8)  |
-					((pixel & header.blue_mask)  >> blue_shift.value  << 0);
-		}
-
-		return pixels; // bottom-up
-	}
-
 	static void init_memory(Thread& thread, Memory& memory) {
 		auto& game_state  = get_game_state(memory);
-		auto& hero_pos    = game_state.hero_pos;
+		auto& entities    = game_state.world.entities;
 		auto& camera_pos  = game_state.camera_pos;
 		auto& tile_map    = game_state.world.tile_map;
 		auto& tile_chunks = game_state.world.tile_map.chunks;
 		auto& world_arena = game_state.world.arena;
+		auto& permanent_arena = game_state.permanent_arena;
+		auto& transient_arena = game_state.transient_arena;
+
+		// мир с начала страницы, остаток постоянной памяти целиком его
+		permanent_arena = { memory.permanent.ptr, memory.permanent.get_size() };
+		permanent_arena.push<Game_State>(size_of(Game_State));
+		world_arena = permanent_arena.push_arena((permanent_arena.size - permanent_arena.used) & ~(PAGE_SIZE - 1), PAGE_SIZE, "world");
+
+		// кэш битмапов из BMP без пака в начале transient, остальное делят кадровые арены. Без отрисовки кэша нет
+		transient_arena = { memory.transient.ptr, memory.transient.get_size() };
+		if (!memory.is_headless) {
+			i64 cache_size = memory.asset_cache_size ? memory.asset_cache_size : Assets::CACHE_DEFAULT_SIZE;
+			cache_size = (cache_size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+			Assets::init_cache(game_state.assets.cache, { transient_arena.push<u8>(cache_size, PAGE_SIZE, "assets"), cache_size });
+			memory.asset_cache_stats = &game_state.assets.cache.stats;
+		}
 
-		world_arena.ptr  = memory.permanent.ptr + size_of(Game_State);
-		world_arena.size = memory.permanent.get_size() - size_of(Game_State);
+		// запас на выравнивание начала, если transient не с начала страницы
+		i64 frame_half_size = (transient_arena.size - transient_arena.used - PAGE_SIZE) / 2 & ~(PAGE_SIZE - 1);
+		for (auto& half : game_state.frame_arena.halves) half = transient_arena.push_arena(frame_half_size, PAGE_SIZE, "frame");
+
+		memory.arenas(Arena_Id::Permanent) = &permanent_arena;
+		memory.arenas(Arena_Id::World)     = &world_arena;
+		memory.arenas(Arena_Id::Transient) = &transient_arena;
+		memory.arenas(Arena_Id::Frame_0)   = &game_state.frame_arena.halves(0);
+		memory.arenas(Arena_Id::Frame_1)   = &game_state.frame_arena.halves(1);
+		if constexpr (DEV_MODE) {
+			for (i32 arena_id = 0; arena_id < Arena_Id::Count; ++arena_id) memory.arenas(arena_id)->sites = &game_state.arena_sites(arena_id);
+		}
 
 		tile_chunks.count_x = Tiles::WORLD_X_CHUNKS;
 		tile_chunks.count_y = Tiles::WORLD_Y_CHUNKS;
 		tile_chunks.count_z = Tiles::WORLD_Z_CHUNKS;
-		tile_chunks.ptr = world_arena.push<Tiles::Chunk>(tile_chunks.get_size());
+		tile_chunks.ptr = world_arena.push<Tiles::Chunk>(tile_chunks.get_size(), CACHE_LINE_SIZE, "tiles");
+		copy_site_name(tile_map.tiles_pool.tag, "tiles");
+		Paths::init_pathfinder(world_arena, tile_map, game_state.world.pathfinder);
+		Paths::init_flow_field(world_arena, tile_map, game_state.hero_flow_field);
+		Rays::init_raycaster(world_arena, tile_map, game_state.world.raycaster);
+		Entities::init_storage(world_arena, tile_map, entities);
+
+		Tiles::Position hero_pos = {};
+		hero_pos.abs_xy = { 1, 1 };
+		hero_pos.tile_rel_add({ Tiles::TILE_DIM / 2, Tiles::TILE_DIM / 2 });
+
+		camera_pos.abs_xy = SCENE_DIM_TILES / 2;
+		camera_pos.abs_z = hero_pos.abs_z;
+		camera_pos.tile_rel.x = Tiles::TILE_DIM / 2;
+
+		// мир из файла используется прямо из отображения, генерируем только если файла нет или он устарел
+		auto& world_file = game_state.world.file;
+		if (!memory.is_world_in_memory) world_file = memory.map_file(thread, "world.hmw");
+		if (!Tiles::load_world(tile_map, world_file, WORLD_GENERATOR_VERSION)) {
+			if (world_file.ptr) memory.unmap_file(thread, world_file);
+
+			// сразу заполняем только чанки рядом с героем, остальные догенерируются в фоне. Для замеров сразу весь мир
+			auto& scratch_arena = game_state.frame_arena.get_current();
+			auto hero_key = Tiles::get_chunk_lookup_key(hero_pos.abs_xy.x, hero_pos.abs_xy.y, hero_pos.abs_z);
+			generate_world_layout(game_state.world);
+			sort_chunk_keys_by_distance(game_state.world.pending_chunk_keys, hero_key, scratch_arena);
+			if (memory.is_world_in_memory) generate_all_chunks(thread, memory, game_state.world, scratch_arena);
+			else                           generate_chunks_around(thread, memory, game_state.world, scratch_arena, hero_key);
+		}
+		assert(Tiles::check_walkable_tile(tile_map, hero_pos));
+		game_state.hero_index = Entities::add_entity(entities, Entities::Type::Hero, hero_pos, HERO_COLLISION_DIM);
+		if constexpr (DEV_MODE) add_familiars(tile_map, entities); // отладочная толпа для проверки поля направлений, в релизе герой один
+		game_state.companion.pos = hero_pos;
+
+		auto& pager = game_state.world.pager;
+		if (memory.low_priority_queue) {
+			pager.file = memory.open_file(thread, "world_pages.hmp");
+			pager.add_work = memory.add_work;
+			pager.read_file_block = memory.read_file_block;
+			pager.write_file_block = memory.write_file_block;
+			if (pager.file.handle) pager.queue = memory.low_priority_queue; // без файла все чанки остаются в памяти
+		}
+
+		auto& raycaster = game_state.world.raycaster;
+		raycaster.queue = memory.high_priority_queue;
+		raycaster.add_work = memory.add_work;
+		raycaster.complete_all_work = memory.complete_all_work;
+
+		// без отрисовки битмапы не нужны
+		if (!memory.is_headless) {
+			auto& assets = game_state.assets;
+			assets.queue = memory.low_priority_queue;
+			assets.add_work = memory.add_work;
+			assets.get_file_size = memory.get_file_size;
+			assets.read_file = memory.read_file;
+
+			slice<u8> pack_file = memory.map_file(thread, "assets.hma");
+			if (!Assets::load_pack(assets.pack, pack_file) && pack_file.ptr) memory.unmap_file(thread, pack_file);
+
+			// грузятся в фоне, первые кадры рисуются без них
+			for (i32 id = 0; id < Assets::Asset_Id::Count; ++id) {
+				Assets::request_asset(thread, assets, cast<Assets::Asset_Id::Type>(id));
+			}
+
+			using namespace Assets::Asset_Id;
+			game_state.hero_bitmaps(Hero_Direction::Front) = { Hero_Front_Head, Hero_Front_Cape, Hero_Front_Torso, {72, 182} };
+			game_state.hero_bitmaps(Hero_Direction::Back)  = { Hero_Back_Head,  Hero_Back_Cape,  Hero_Back_Torso,  {72, 182} };
+			game_state.hero_bitmaps(Hero_Direction::Left)  = { Hero_Left_Head,  Hero_Left_Cape,  Hero_Left_Torso,  {72, 182} };
+			game_state.hero_bitmaps(Hero_Direction::Right) = { Hero_Right_Head, Hero_Right_Cape, Hero_Right_Torso, {72, 182} };
+		}
+		
+		memory.is_initialized = true;
+	}
+
+	static void generate_world_layout(World& world) {
+		auto& tile_map = world.tile_map;
+		auto& scenes   = world.scenes;
+		auto& pending_chunk_keys = world.pending_chunk_keys;
+
+		scenes.count_x = (tile_map.chunks.count_x * Tiles::CHUNK_DIM_TILES + SCENE_DIM_TILES.x - 1) / SCENE_DIM_TILES.x;
+		scenes.count_y = (tile_map.chunks.count_y * Tiles::CHUNK_DIM_TILES + SCENE_DIM_TILES.y - 1) / SCENE_DIM_TILES.y;
+		scenes.count_z = tile_map.chunks.count_z;
+		scenes.ptr = world.arena.push<Scene_Layout>(scenes.get_size());
 
+		// сцена 17x9 задевает не больше 2x2 чанков
+		pending_chunk_keys = {};
+		pending_chunk_keys.ptr = world.arena.push<Tiles::Chunk_Lookup_Key>(4 * WORLD_SCENES_COUNT * size_of(Tiles::Chunk_Lookup_Key));
+		world.next_pending_chunk = 0;
+		world.is_save_needed = true;
+
+		// последовательный проход: двери и лестницы каждой сцены, случайные числа берутся по порядку.
+		// Тайлы чанков заполняются позже, до этого get_tile возвращает Not_Generated
 		i32 abs_tile_z = 0;
 		v2<i32> scene = {};
 		bool is_door_left = false, is_door_right  = false;
 		bool is_door_top  = false, is_door_bottom = false;
 		bool is_stairs_up = false, is_stairs_down = false;
 
-		i32 scenes_count = 100;
-		for (i32 scene_index = 0; scene_index < scenes_count; ++scene_index) {
+		for (i32 scene_index = 0; scene_index < WORLD_SCENES_COUNT; ++scene_index) {
 			i32 random_choice_3 = is_stairs_up || is_stairs_down
 				? RANDOM_NUMBERS_TABLE(scene_index) % 2
 				: RANDOM_NUMBERS_TABLE(scene_index) % 3;
@@ -277,30 +400,29 @@ namespace Game {
 				assert(fact_doors_count == correct_doors_count);
 			}
 
-			for (    i32 tile_y = 0; tile_y < SCENE_DIM_TILES.y; ++tile_y) {
-				for (i32 tile_x = 0; tile_x < SCENE_DIM_TILES.x; ++tile_x) {
-					i32 abs_tile_x = scene.x * SCENE_DIM_TILES.x + tile_x;
-					i32 abs_tile_y = scene.y * SCENE_DIM_TILES.y + tile_y;
-
-					auto tile_value = Tiles::Tile::Floor;
-					if (tile_x == 0 || tile_x == SCENE_DIM_TILES.x - 1 ||
-					    tile_y == 0 || tile_y == SCENE_DIM_TILES.y - 1) {
-						tile_value = Tiles::Tile::Wall;
-					}
-
-					if ((is_door_left   && tile_x == 0                     && tile_y == SCENE_DIM_TILES.y / 2) ||
-				        (is_door_right  && tile_x == SCENE_DIM_TILES.x - 1 && tile_y == SCENE_DIM_TILES.y / 2) ||
-					    (is_door_top    && tile_x == SCENE_DIM_TILES.x / 2 && tile_y == SCENE_DIM_TILES.y - 1) ||
-					    (is_door_bottom && tile_x == SCENE_DIM_TILES.x / 2 && tile_y == 0                     )) {
-						tile_value = Tiles::Tile::Floor;
-					}
-
-					if (tile_x == SCENE_DIM_TILES.x / 2 && tile_y == SCENE_DIM_TILES.y / 2) {
-						if (is_stairs_up)   tile_value = Tiles::Tile::Stairs_Up;
-						if (is_stairs_down) tile_value = Tiles::Tile::Stairs_Down;
-					}
-					
-					Tiles::set_tile(world_arena, tile_map, abs_tile_x, abs_tile_y, abs_tile_z, tile_value);
+			auto& layout = scenes(scene.x, scene.y, abs_tile_z);
+			assert(!layout.is_present);
+			layout.is_present   = true;
+			layout.is_door_left   = is_door_left;
+			layout.is_door_right  = is_door_right;
+			layout.is_door_top    = is_door_top;
+			layout.is_door_bottom = is_door_bottom;
+			layout.is_stairs_up   = is_stairs_up;
+			layout.is_stairs_down = is_stairs_down;
+
+			v2<i32> scene_min = { scene.x * SCENE_DIM_TILES.x, scene.y * SCENE_DIM_TILES.y };
+			v2<i32> scene_max = scene_min + SCENE_DIM_TILES - v2<i32>{1, 1};
+			auto key_min = Tiles::get_chunk_lookup_key(scene_min.x, scene_min.y, abs_tile_z);
+			auto key_max = Tiles::get_chunk_lookup_key(scene_max.x, scene_max.y, abs_tile_z);
+
+			for (    i32 key_y = key_min.y; key_y <= key_max.y; ++key_y) {
+				for (i32 key_x = key_min.x; key_x <= key_max.x; ++key_x) {
+					auto& chunk = tile_map.chunks(key_x, key_y, abs_tile_z);
+					if (chunk.state == Tiles::Chunk_State::Generating) continue;
+
+					chunk.state = Tiles::Chunk_State::Generating;
+					pending_chunk_keys.ptr[pending_chunk_keys.count] = { key_x, key_y, abs_tile_z };
+					pending_chunk_keys.count += 1;
 				}
 			}
 
@@ -320,38 +442,514 @@ namespace Game {
 			is_door_right = false;
 			is_door_top = false;
 		}
+	}
 
-		hero_pos.abs_xy = { 1, 1 };
-		hero_pos.tile_rel_add({ Tiles::TILE_DIM / 2, Tiles::TILE_DIM / 2 });
-		assert(Tiles::check_walkable_tile(tile_map, hero_pos));
+	static void sort_chunk_keys_by_distance(slice<Tiles::Chunk_Lookup_Key> keys, Tiles::Chunk_Lookup_Key center, Arena& scratch_arena) {
+		// сортировка подсчётом по расстоянию Чебышёва в чанках, равные сохраняют порядок
+		auto get_distance = [&](Tiles::Chunk_Lookup_Key key) { return hm::max(hm::abs(key.x - center.x), hm::abs(key.y - center.y)); };
+		auto temp = scratch_arena.begin_temp();
+		defer(scratch_arena.end_temp(temp));
 
-		camera_pos.abs_xy = SCENE_DIM_TILES / 2;
+		slice<i64> offsets = {};
+		offsets.count = hm::max(Tiles::WORLD_X_CHUNKS, Tiles::WORLD_Y_CHUNKS) + 1;
+		offsets.ptr = scratch_arena.push<i64>(offsets.get_size());
+		for (auto& offset : offsets) offset = 0;
+
+		slice<Tiles::Chunk_Lookup_Key> sorted = {};
+		sorted.count = keys.count;
+		sorted.ptr = scratch_arena.push<Tiles::Chunk_Lookup_Key>(sorted.get_size());
+
+		for (auto& key : keys) offsets(get_distance(key)) += 1;
+
+		i64 offset = 0;
+		for (auto& distance_offset : offsets) {
+			i64 distance_count = distance_offset;
+			distance_offset = offset;
+			offset += distance_count;
+		}
+
+		for (auto& key : keys) {
+			auto& distance_offset = offsets(get_distance(key));
+			sorted(distance_offset) = key;
+			distance_offset += 1;
+		}
+		for (i64 i = 0; i < keys.count; ++i) keys(i) = sorted(i);
+	}
+
+	static void update_world_generator(Thread& thread, Memory& memory, World& world, Arena& scratch_arena, Tiles::Position& camera_pos) {
+		auto& tile_map = world.tile_map;
+		auto& pending_chunk_keys = world.pending_chunk_keys;
+
+		bool is_any_job_running = false;
+		for (auto& job : world.background_jobs) {
+			if (!job.world) continue;
+			if (!job.is_done) {
+				is_any_job_running = true;
+				continue;
+			}
+			finish_generated_chunks(world, job.chunk_keys);
+			job = {};
+		}
+
+		if (world.next_pending_chunk == pending_chunk_keys.count) {
+			if (memory.is_headless) world.is_save_needed = false; // общий файл мира пишет только обычный запуск
+			if (world.is_save_needed && !is_any_job_running) {
+				auto temp = scratch_arena.begin_temp();
+				defer(scratch_arena.end_temp(temp));
+				// если файл пейджера не читается, повтор в следующем кадре не поможет, мир останется несохранённым
+				slice<u8> world_file = Tiles::save_world(thread, scratch_arena, tile_map, world.pager, WORLD_GENERATOR_VERSION);
+				if (world_file.ptr) memory.write_file(thread, "world.hmw", world_file);
+				world.is_save_needed = false;
+			}
+			return;
+		}
+
+		// камера может обогнать фон, тогда ближайшие чанки генерируем прямо в этом кадре
+		auto camera_key = Tiles::get_chunk_lookup_key(camera_pos.abs_xy.x, camera_pos.abs_xy.y, camera_pos.abs_z);
+		generate_chunks_around(thread, memory, world, scratch_arena, camera_key);
+
+		for (auto& job : world.background_jobs) {
+			if (job.world) continue;
+
+			// ключи уплотняются прямо в очереди, уже сгенерированные чанки пропускаются
+			job.chunk_keys = {};
+			job.chunk_keys.ptr = pending_chunk_keys.ptr + world.next_pending_chunk;
+			while (world.next_pending_chunk < pending_chunk_keys.count && job.chunk_keys.count < GENERATE_BACKGROUND_CHUNKS_PER_JOB) {
+				auto key = pending_chunk_keys(world.next_pending_chunk);
+				world.next_pending_chunk += 1;
+
+				auto& chunk = tile_map.chunks(key.x, key.y, key.z);
+				if (chunk.state != Tiles::Chunk_State::Generating || chunk.tiles) continue;
+
+				Tiles::add_chunk_tiles(world.arena, tile_map, chunk);
+				job.chunk_keys.ptr[job.chunk_keys.count] = key;
+				job.chunk_keys.count += 1;
+			}
+			if (!job.chunk_keys.count) break;
+
+			job.world = &world;
+			job.is_done = false;
+			if (memory.low_priority_queue) memory.add_work(thread, *memory.low_priority_queue, do_generate_job, &job);
+			else                           do_generate_job(thread, &job);
+		}
+	}
+
+	static void generate_chunks_around(Thread& thread, Memory& memory, World& world, Arena& scratch_arena, Tiles::Chunk_Lookup_Key center) {
+		auto& tile_map = world.tile_map;
+		i32 radius = GENERATE_NEAR_RADIUS_CHUNKS;
+		auto temp = scratch_arena.begin_temp();
+		defer(scratch_arena.end_temp(temp));
+
+		slice<Tiles::Chunk_Lookup_Key> chunk_keys = {};
+		chunk_keys.ptr = scratch_arena.push<Tiles::Chunk_Lookup_Key>((2 * radius + 1) * (2 * radius + 1) * tile_map.chunks.count_z * size_of(Tiles::Chunk_Lookup_Key));
+
+		// лестницы ведут на другой этаж, поэтому берём все этажи
+		for (        i32 z = 0; z < tile_map.chunks.count_z; ++z) {
+			for (    i32 y = hm::max(center.y - radius, 0); y <= hm::min(center.y + radius, tile_map.chunks.count_y - 1); ++y) {
+				for (i32 x = hm::max(center.x - radius, 0); x <= hm::min(center.x + radius, tile_map.chunks.count_x - 1); ++x) {
+					auto& chunk = tile_map.chunks(x, y, z);
+					if (chunk.state != Tiles::Chunk_State::Generating || chunk.tiles) continue; // фоновая задача уже заполняет
+
+					Tiles::add_chunk_tiles(world.arena, tile_map, chunk);
+					chunk_keys.ptr[chunk_keys.count] = { x, y, z };
+					chunk_keys.count += 1;
+				}
+			}
+		}
+		if (!chunk_keys.count) return;
+
+		generate_chunks(thread, memory, world, scratch_arena, chunk_keys);
+		finish_generated_chunks(world, chunk_keys);
+	}
+
+	// все ещё не сгенерированные чанки сразу, фону ничего не остаётся
+	static void generate_all_chunks(Thread& thread, Memory& memory, World& world, Arena& scratch_arena) {
+		auto& tile_map = world.tile_map;
+		auto temp = scratch_arena.begin_temp();
+		defer(scratch_arena.end_temp(temp));
+
+		slice<Tiles::Chunk_Lookup_Key> chunk_keys = {};
+		chunk_keys.ptr = scratch_arena.push<Tiles::Chunk_Lookup_Key>(world.pending_chunk_keys.get_size());
+		for (auto& key : world.pending_chunk_keys) {
+			auto& chunk = tile_map.chunks(key.x, key.y, key.z);
+			if (chunk.state != Tiles::Chunk_State::Generating || chunk.tiles) continue;
+
+			Tiles::add_chunk_tiles(world.arena, tile_map, chunk);
+			chunk_keys.ptr[chunk_keys.count] = key;
+			chunk_keys.count += 1;
+		}
+		world.next_pending_chunk = world.pending_chunk_keys.count;
+		if (!chunk_keys.count) return;
+
+		generate_chunks(thread, memory, world, scratch_arena, chunk_keys);
+		finish_generated_chunks(world, chunk_keys);
+	}
+
+	static void generate_chunks(Thread& thread, Memory& memory, World& world, Arena& scratch_arena, slice<Tiles::Chunk_Lookup_Key> chunk_keys) {
+		// каждый чанк целиком заполняет одна задача, тайлы зависят только от раскладки сцен
+		i64 chunks_per_job = hm::max(GENERATE_CHUNKS_PER_JOB, (chunk_keys.count + GENERATE_MAX_JOBS - 1) / GENERATE_MAX_JOBS);
+		slice<Generate_Job> jobs = {};
+		jobs.count = (chunk_keys.count + chunks_per_job - 1) / chunks_per_job;
+		jobs.ptr = scratch_arena.push<Generate_Job>(jobs.get_size());
+
+		for (i64 job_index = 0; job_index < jobs.count; ++job_index) {
+			auto& job = jobs(job_index);
+			job = {};
+			job.world = &world;
+			job.chunk_keys.ptr   = chunk_keys.ptr + job_index * chunks_per_job;
+			job.chunk_keys.count = hm::min(chunks_per_job, chunk_keys.count - job_index * chunks_per_job);
+
+			if (memory.high_priority_queue) memory.add_work(thread, *memory.high_priority_queue, do_generate_job, &job);
+			else                            do_generate_job(thread, &job);
+		}
+		if (memory.high_priority_queue) memory.complete_all_work(thread, *memory.high_priority_queue);
+	}
+
+	static void finish_generated_chunks(World& world, slice<Tiles::Chunk_Lookup_Key> chunk_keys) {
+		auto& tile_map = world.tile_map;
+		for (auto& key : chunk_keys) {
+			auto& chunk = tile_map.chunks(key.x, key.y, key.z);
+			assert(chunk.state == Tiles::Chunk_State::Generating);
+			chunk.state = Tiles::Chunk_State::Resident;
+			Tiles::share_chunk_tiles(tile_map, chunk); // одинаковые чанки хранятся один раз
+		}
+	}
+
+	static void do_generate_job(Thread& thread, void* data) {
+		auto& job = *cast<Generate_Job*>(data);
+		auto& world = *job.world;
+
+		for (auto& key : job.chunk_keys) {
+			auto& tiles = *world.tile_map.chunks(key.x, key.y, key.z).tiles;
+
+			for (    i32 chunk_y = 0; chunk_y < Tiles::CHUNK_DIM_TILES; ++chunk_y) {
+				for (i32 chunk_x = 0; chunk_x < Tiles::CHUNK_DIM_TILES; ++chunk_x) {
+					i32 abs_tile_x = (key.x << Tiles::CHUNK_LOOKUP_KEY_SHIFT) + chunk_x;
+					i32 abs_tile_y = (key.y << Tiles::CHUNK_LOOKUP_KEY_SHIFT) + chunk_y;
+
+					auto& scene = world.scenes(abs_tile_x / SCENE_DIM_TILES.x, abs_tile_y / SCENE_DIM_TILES.y, key.z);
+					tiles(chunk_x, chunk_y) = get_scene_tile(scene, abs_tile_x % SCENE_DIM_TILES.x, abs_tile_y % SCENE_DIM_TILES.y);
+				}
+			}
+		}
+		job.is_done = true;
+	}
+
+	static void simulate_tick(Thread& thread, Input& input, Memory& memory, Game_State& game_state) {
+		auto& entities   = game_state.world.entities;
+		auto& camera_pos = game_state.camera_pos;
+		auto& tile_map   = game_state.world.tile_map;
+		auto& flow_field = game_state.hero_flow_field;
+
+		// за кадр бывает несколько тиков, каждый отдаёт свою память обратно
+		auto& scratch_arena = game_state.frame_arena.get_current();
+		auto temp = scratch_arena.begin_temp();
+		defer(scratch_arena.end_temp(temp));
+		auto sim_region = Entities::begin_sim(scratch_arena, entities, camera_pos, SIM_REGION_RADIUS);
+		auto sim_grid = Spatial::build_grid(scratch_arena, camera_pos, sim_region.positions, sim_region.dims); // соседей ищем по позициям начала тика
+		i32 hero_sim_index = Entities::find_sim_index(sim_region, game_state.hero_index);
+		auto sees_hero = find_familiars_seeing_hero(thread, scratch_arena, tile_map, game_state.world.raycaster, sim_region, hero_sim_index);
+
+		// задачи режем по границам чанков. Сущности, переходящие через границу, видят соседей только через сетку
+		// начала тика, поэтому результат не зависит ни от разбиения, ни от числа потоков
+		// задач не больше, чем отрезков из одного чанка, поэтому массив берём сразу на их число
+		i32 chunk_runs_count = 0;
+		Tiles::Chunk_Lookup_Key prev_key = { -1, -1, -1 };
+		for (i32 sim_index = 0; sim_index < sim_region.count; ++sim_index) {
+			auto& key = entities.chunk_keys(sim_region.storage_indices(sim_index));
+			if (key.x != prev_key.x || key.y != prev_key.y || key.z != prev_key.z) chunk_runs_count += 1;
+			prev_key = key;
+		}
+
+		slice<Sim_Job> jobs = {};
+		jobs.ptr = scratch_arena.push<Sim_Job>(chunk_runs_count * size_of(Sim_Job));
+		prev_key = { -1, -1, -1 };
+		for (i32 sim_index = 0; sim_index < sim_region.count; ++sim_index) {
+			auto& key = entities.chunk_keys(sim_region.storage_indices(sim_index));
+			bool is_new_chunk = key.x != prev_key.x || key.y != prev_key.y || key.z != prev_key.z;
+			prev_key = key;
+			if (!is_new_chunk) continue;
+
+			Paths::prepare_flow_chunk(tile_map, flow_field, key);
+			if (jobs.count && sim_index - jobs(jobs.count - 1).first_sim_index < SIM_ENTITIES_PER_JOB) continue;
+
+			if (jobs.count) jobs(jobs.count - 1).end_sim_index = sim_index;
+			assert(jobs.count < chunk_runs_count);
+			jobs.ptr[jobs.count] = { &input, &tile_map, &flow_field, &sim_grid, &sim_region, sees_hero, hero_sim_index, sim_index, sim_region.count };
+			jobs.count += 1;
+		}
+
+		for (auto& job : jobs) {
+			if (memory.high_priority_queue) memory.add_work(thread, *memory.high_priority_queue, do_sim_job, &job);
+			else                            do_sim_job(thread, &job);
+		}
+		if (memory.high_priority_queue) memory.complete_all_work(thread, *memory.high_priority_queue);
+		Entities::end_sim(entities, sim_region);
+
+		auto& hero_pos = entities.positions(game_state.hero_index);
 		camera_pos.abs_z = hero_pos.abs_z;
-		camera_pos.tile_rel.x = Tiles::TILE_DIM / 2;
 
-		game_state.background_bitmap = load_bmp(thread, memory.read_file, "test/test_background.bmp");
+		for (i32 axis = 0; axis < 2; ++axis) {
+			i32 abs_diff = hero_pos.abs_xy(axis) - camera_pos.abs_xy(axis);
+			if (hm::abs(abs_diff) > SCENE_DIM_TILES(axis) / 2) {
+				camera_pos.abs_xy(axis) += SCENE_DIM_TILES(axis) * hm::sign<i32>(abs_diff);
+			}
+		}
 
-		game_state.hero_bitmaps(Hero_Direction::Front).head  = load_bmp(thread, memory.read_file, "test/test_hero_front_head.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Front).cape  = load_bmp(thread, memory.read_file, "test/test_hero_front_cape.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Front).torso = load_bmp(thread, memory.read_file, "test/test_hero_front_torso.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Front).align = {72, 182};
+		Paths::update_flow_field(game_state.world.arena, scratch_arena, tile_map, game_state.world.pathfinder, game_state.hero_flow_field, hero_pos);
+		game_state.sim_tick += 1;
+		if (game_state.sim_tick % STATE_HASH_INTERVAL_TICKS == 0) memory.state_hash = get_state_hash(game_state, scratch_arena);
+	}
 
-		game_state.hero_bitmaps(Hero_Direction::Back).head   = load_bmp(thread, memory.read_file, "test/test_hero_back_head.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Back).cape   = load_bmp(thread, memory.read_file, "test/test_hero_back_cape.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Back).torso  = load_bmp(thread, memory.read_file, "test/test_hero_back_torso.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Back).align  = {72, 182};
+	static void do_sim_job(Thread& thread, void* data) {
+		auto& job = *cast<Sim_Job*>(data);
+		auto& region = *job.region;
 
-		game_state.hero_bitmaps(Hero_Direction::Left).head   = load_bmp(thread, memory.read_file, "test/test_hero_left_head.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Left).cape   = load_bmp(thread, memory.read_file, "test/test_hero_left_cape.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Left).torso  = load_bmp(thread, memory.read_file, "test/test_hero_left_torso.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Left).align  = {72, 182};
+		for (i32 sim_index = job.first_sim_index; sim_index < job.end_sim_index; ++sim_index) {
+			switch (region.types(sim_index)) {
+				case Entities::Type::None:     break;
+				case Entities::Type::Hero:     update_hero(*job.input, *job.map, region, sim_index, SIM_TICK_DT); break;
+				case Entities::Type::Familiar: update_familiar(*job.map, *job.flow_field, *job.grid, region, sim_index, job.hero_sim_index, job.sees_hero(sim_index), SIM_TICK_DT); break;
+			}
+		}
+	}
 
-		game_state.hero_bitmaps(Hero_Direction::Right).head  = load_bmp(thread, memory.read_file, "test/test_hero_right_head.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Right).cape  = load_bmp(thread, memory.read_file, "test/test_hero_right_cape.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Right).torso = load_bmp(thread, memory.read_file, "test/test_hero_right_torso.bmp");
-		game_state.hero_bitmaps(Hero_Direction::Right).align = {72, 182};
-		
-		memory.is_initialized = true;
+	// только то, что однозначно следует из входа: пейджер, фоновая генерация и кеши путей зависят от времени и не входят
+	static State_Hash get_state_hash(Game_State& game_state, Arena& scratch_arena) {
+		auto& entities = game_state.world.entities;
+		auto& chunks   = game_state.world.tile_map.chunks;
+		i64 count = entities.count;
+
+		State_Hash state_hash = {};
+		state_hash.tick = game_state.sim_tick;
+
+		auto& sim_hash = state_hash.blocks(State_Hash_Block::Sim);
+		sim_hash = hm::hash_bytes({ &game_state.camera_pos, 1 });
+		sim_hash = hm::hash_bytes({ &game_state.hero_index, 1 }, sim_hash);
+		sim_hash = hm::hash_bytes({ &game_state.sim_time_accumulator, 1 }, sim_hash);
+		sim_hash = hm::hash_bytes({ &game_state.sim_tick, 1 }, sim_hash);
+		sim_hash = hm::hash_bytes({ &entities.count, 1 }, sim_hash);
+		sim_hash = hm::hash_bytes({ &entities.first_free, 1 }, sim_hash);
+
+		state_hash.blocks(State_Hash_Block::Entity_Types)          = hm::hash_bytes({ entities.types.ptr, count });
+		state_hash.blocks(State_Hash_Block::Entity_Positions)      = hm::hash_bytes({ entities.positions.ptr, count });
+		state_hash.blocks(State_Hash_Block::Entity_Prev_Positions) = hm::hash_bytes({ entities.prev_positions.ptr, count });
+		state_hash.blocks(State_Hash_Block::Entity_Velocities)     = hm::hash_bytes({ entities.velocities.ptr, count });
+		state_hash.blocks(State_Hash_Block::Entity_Facings)        = hm::hash_bytes({ entities.facings.ptr, count });
+
+		auto& links_hash = state_hash.blocks(State_Hash_Block::Entity_Chunk_Links);
+		links_hash = hm::hash_bytes({ entities.chunk_next.ptr, count });
+		links_hash = hm::hash_bytes({ entities.chunk_prev.ptr, count }, links_hash);
+		links_hash = hm::hash_bytes({ entities.chunk_keys.ptr, count }, links_hash);
+
+		// версии тайлов меняются только при записи в тайлы, собираем их подряд, чтобы хешировать одним куском
+		slice<u16> tiles_versions = {};
+		tiles_versions.count = chunks.count_x * chunks.count_y * chunks.count_z;
+		tiles_versions.ptr = scratch_arena.push<u16>(tiles_versions.get_size());
+		for (i64 chunk_index = 0; chunk_index < tiles_versions.count; ++chunk_index) {
+			tiles_versions(chunk_index) = chunks.ptr[chunk_index].tiles_version;
+		}
+		state_hash.blocks(State_Hash_Block::Tiles_Versions) = hm::hash_bytes(tiles_versions);
+
+		for (auto block_hash : state_hash.blocks) state_hash.total = hm::hash_bytes({ &block_hash, 1 }, state_hash.total);
+		return state_hash;
+	}
+
+	static void update_hero(Input& input, Tiles::Map& map, Entities::Sim_Region& region, i32 sim_index, f32 dt) {
+		auto& d_hero_pos = region.velocities(sim_index);
+		auto& hero_dir   = region.facings(sim_index);
+
+		for (auto& controller : input.controllers) {
+			v2<f32> dd_hero_pos = {};
+			f32 dd_hero_amp = controller.action_down.is_pressed ? 50.0f : 10.0f;
+
+			if (controller.move_left.is_pressed) {
+				hero_dir = Hero_Direction::Left;
+				dd_hero_pos.x -= dd_hero_amp;
+			}
+			if (controller.move_right.is_pressed) {
+				hero_dir = Hero_Direction::Right;
+				dd_hero_pos.x += dd_hero_amp;
+			}
+			if (controller.move_up.is_pressed) {
+				hero_dir = Hero_Direction::Back;
+				dd_hero_pos.y += dd_hero_amp;
+			}
+			if (controller.move_down.is_pressed) {
+				hero_dir = Hero_Direction::Front;
+				dd_hero_pos.y -= dd_hero_amp;
+			}
+			if (dd_hero_pos.x && dd_hero_pos.y) {
+				dd_hero_pos /= SQRT_2;
+			}
+			dd_hero_pos -= 2.0f * d_hero_pos;
+
+			move_entity(map, region, sim_index, dd_hero_pos, dt);
+		}
+	}
+
+	// фамильяры идут к видимому герою напрямую, иначе по общему полю направлений, и расталкивают друг друга.
+	// Герой ещё двигается в своей задаче, поэтому его позицию берём из сетки начала тика
+	static void update_familiar(Tiles::Map& map, Paths::Flow_Field& field, Spatial::Grid& grid, Entities::Sim_Region& region, i32 sim_index, i32 hero_sim_index, bool sees_hero, f32 dt) {
+		v2<f32> dir = {};
+		if (sees_hero) {
+			v2<f32> diff = grid.centers(hero_sim_index) - grid.centers(sim_index);
+			f32 distance = std::sqrt(dot(diff, diff));
+			if (distance > FAMILIAR_FOLLOW_DISTANCE) dir = diff / distance;
+		} else {
+			dir = cast<v2<f32>>(Paths::get_flow_step(map, field, region.positions(sim_index)));
+		}
+		v2<f32> dd_pos = dir * FAMILIAR_ACCELERATION - 2.0f * region.velocities(sim_index);
+
+		Array<i32, FAMILIAR_MAX_NEIGHBOURS> neighbours;
+		i64 found = Spatial::query_radius(grid, region.positions(sim_index), FAMILIAR_SEPARATION_RADIUS, neighbours.ptr);
+		i32 neighbours_count = cast<i32>(hm::min<i64>(found, FAMILIAR_MAX_NEIGHBOURS));
+		for (i32 neighbour = 0; neighbour < neighbours_count; ++neighbour) {
+			i32 other = neighbours(neighbour);
+			if (other == sim_index) continue;
+
+			v2<f32> diff = grid.centers(sim_index) - grid.centers(other);
+			f32 distance = std::sqrt(dot(diff, diff));
+			if (distance == 0 || distance >= FAMILIAR_SEPARATION_RADIUS) continue;
+			dd_pos += diff / distance * FAMILIAR_SEPARATION_ACCELERATION * (1 - distance / FAMILIAR_SEPARATION_RADIUS);
+		}
+		move_entity(map, region, sim_index, dd_pos, dt);
+	}
+
+	// лучи пускаем все сразу до задач симуляции: маски стен обновляются только здесь, в задачах их только читают
+	static slice<bool> find_familiars_seeing_hero(Thread& thread, Arena& scratch_arena, Tiles::Map& map, Rays::Raycaster& raycaster, Entities::Sim_Region& region, i32 hero_sim_index) {
+		slice<bool> sees_hero = {};
+		sees_hero.count = region.count;
+		sees_hero.ptr = scratch_arena.push<bool>(sees_hero.get_size());
+		for (auto& sees : sees_hero) sees = false;
+		if (hero_sim_index == Entities::NO_ENTITY) return sees_hero;
+
+		slice<Rays::Ray> rays = {};
+		slice<i32> ray_sim_indices = {};
+		rays.ptr = scratch_arena.push<Rays::Ray>(region.count * size_of(Rays::Ray));
+		ray_sim_indices.ptr = scratch_arena.push<i32>(region.count * size_of(i32));
+
+		auto& hero_pos = region.positions(hero_sim_index);
+		for (i32 sim_index = 0; sim_index < region.count; ++sim_index) {
+			auto& pos = region.positions(sim_index);
+			if (region.types(sim_index) != Entities::Type::Familiar || pos.abs_z != hero_pos.abs_z) continue;
+
+			v2<f32> diff = Tiles::subtract_positions(hero_pos, pos);
+			f32 distance = std::sqrt(dot(diff, diff));
+			if (distance == 0) {
+				sees_hero(sim_index) = true;
+				continue;
+			}
+			rays.ptr[rays.count] = { pos, diff / distance, distance };
+			ray_sim_indices.ptr[rays.count] = sim_index;
+			rays.count += 1;
+			ray_sim_indices.count += 1;
+		}
+
+		slice<Rays::Ray_Hit> hits = {};
+		hits.count = rays.count;
+		hits.ptr = scratch_arena.push<Rays::Ray_Hit>(hits.get_size());
+		Rays::raycast_batch(thread, scratch_arena, map, raycaster, rays, hits);
+		for (i64 ray_index = 0; ray_index < rays.count; ++ray_index) {
+			sees_hero(ray_sim_indices(ray_index)) = !hits(ray_index).is_hit;
+		}
+		return sees_hero;
+	}
+
+	static void move_entity(Tiles::Map& map, Entities::Sim_Region& region, i32 sim_index, v2<f32> dd_pos, f32 dt) {
+		auto& pos   = region.positions(sim_index);
+		auto& d_pos = region.velocities(sim_index);
+
+		auto new_pos = pos;
+		v2<f32> delta = dd_pos / 2 * dt * dt + d_pos * dt;
+		d_pos += dd_pos * dt;
+		Collision::move_and_slide(map, new_pos, d_pos, region.dims(sim_index), delta);
+
+		if (!Tiles::check_same_tile(pos, new_pos)) {
+			auto new_tile = Tiles::get_tile(map, new_pos.abs_xy.x, new_pos.abs_xy.y, new_pos.abs_z);
+			if (new_tile == Tiles::Tile::Stairs_Up)   new_pos.abs_z += 1;
+			if (new_tile == Tiles::Tile::Stairs_Down) new_pos.abs_z -= 1;
+		}
+		pos = new_pos;
+	}
+
+	// второй ряд первой сцены, занятые тайлы пропускаем
+	static void add_familiars(Tiles::Map& map, Entities::Storage& entities) {
+		i32 added = 0;
+		for (i32 x = 2; x < SCENE_DIM_TILES.x - 1 && added < FAMILIARS_COUNT; x += 2) {
+			Tiles::Position pos = {};
+			pos.abs_xy = { x, 2 };
+			pos.tile_rel_add({ Tiles::TILE_DIM / 2, Tiles::TILE_DIM / 2 });
+			if (!Tiles::check_walkable_tile(map, pos)) continue;
+
+			Entities::add_entity(entities, Entities::Type::Familiar, pos, FAMILIAR_COLLISION_DIM);
+			added += 1;
+		}
+	}
+
+	// путь к герою запрашивается заново, когда герой ушёл от его цели или спутник сбился. Пока путь ищется, спутник стоит
+	static void update_companion(Game_State& game_state, f32 dt) {
+		auto& companion  = game_state.companion;
+		auto& pathfinder = game_state.world.pathfinder;
+		auto& tile_map   = game_state.world.tile_map;
+		auto& hero_pos   = game_state.world.entities.positions(game_state.hero_index);
+
+		auto get_tiles_apart = [&](Paths::Path_Point point) {
+			v2<i32> diff = hero_pos.abs_xy - point.abs_xy;
+			return point.abs_z == hero_pos.abs_z ? hm::abs(diff.x) + hm::abs(diff.y) : INT32_MAX;
+		};
+
+		auto* path = companion.path;
+		if (path && path->state != Paths::Path_State::Queued) {
+			bool is_lost = false;
+			if (path->state == Paths::Path_State::Found) {
+				auto step = Paths::get_path_step(pathfinder, tile_map, *path, companion.pos);
+				is_lost = step == v2<i32>{} && path->next_waypoint < path->waypoints_count;
+			}
+			if (is_lost || get_tiles_apart(path->goal) > COMPANION_REPATH_TILES) {
+				Paths::release_path(pathfinder, path);
+				companion.path = nullptr;
+			}
+		}
+		if (!companion.path) companion.path = Paths::request_path(game_state.world.arena, pathfinder, companion.pos, hero_pos);
+		if (!companion.path) return;
+
+		companion.step_time += dt;
+		if (companion.step_time < COMPANION_SECONDS_PER_TILE) return;
+		companion.step_time = 0;
+		if (get_tiles_apart(Paths::get_path_point(companion.pos)) <= COMPANION_FOLLOW_TILES) return;
+
+		auto step = Paths::get_path_step(pathfinder, tile_map, *companion.path, companion.pos);
+		if (step == v2<i32>{}) return;
+
+		// как у сущностей, лестница переносит на другой этаж при входе на неё
+		companion.pos.abs_xy += step;
+		auto tile = Tiles::get_tile(tile_map, companion.pos.abs_xy.x, companion.pos.abs_xy.y, companion.pos.abs_z);
+		if (tile == Tiles::Tile::Stairs_Up)   companion.pos.abs_z += 1;
+		if (tile == Tiles::Tile::Stairs_Down) companion.pos.abs_z -= 1;
+	}
+
+	static Tiles::Tile get_scene_tile(Scene_Layout& scene, i32 tile_x, i32 tile_y) {
+		if (!scene.is_present) return Tiles::Tile::Floor;
+
+		auto tile_value = Tiles::Tile::Floor;
+		if (tile_x == 0 || tile_x == SCENE_DIM_TILES.x - 1 ||
+		    tile_y == 0 || tile_y == SCENE_DIM_TILES.y - 1) {
+			tile_value = Tiles::Tile::Wall;
+		}
+
+		if ((scene.is_door_left   && tile_x == 0                     && tile_y == SCENE_DIM_TILES.y / 2) ||
+		    (scene.is_door_right  && tile_x == SCENE_DIM_TILES.x - 1 && tile_y == SCENE_DIM_TILES.y / 2) ||
+		    (scene.is_door_top    && tile_x == SCENE_DIM_TILES.x / 2 && tile_y == SCENE_DIM_TILES.y - 1) ||
+		    (scene.is_door_bottom && tile_x == SCENE_DIM_TILES.x / 2 && tile_y == 0                     )) {
+			tile_value = Tiles::Tile::Floor;
+		}
+
+		if (tile_x == SCENE_DIM_TILES.x / 2 && tile_y == SCENE_DIM_TILES.y / 2) {
+			if (scene.is_stairs_up)   tile_value = Tiles::Tile::Stairs_Up;
+			if (scene.is_stairs_down) tile_value = Tiles::Tile::Stairs_Down;
+		}
+		return tile_value;
 	}
 
 	static u32 get_hex_color(Color color) {
@@ -1,12 +1,45 @@
 #pragma once
 
+#include "assets.hpp"
+#include "collision.hpp"
+#include "entities.hpp"
+#include "files.hpp"
 #include "globals.hpp"
+#include "paths.hpp"
+#include "platform.hpp"
 #include "random.hpp"
+#include "rays.hpp"
+#include "spatial.hpp"
 #include "tiles.hpp"
 
 namespace Game {
 	static constexpr v2<i32> SCENE_DIM_TILES = { 17, 9 };
 	static constexpr i32 SCENES_PER_SCREEN = 1;
+	static constexpr v2<f32> HERO_COLLISION_DIM = { 1.0f, 0.5f };
+	static constexpr v2<f32> FAMILIAR_COLLISION_DIM = { 0.5f, 0.5f };
+	static constexpr f32 FAMILIAR_ACCELERATION = 6.0f;
+	static constexpr f32 FAMILIAR_SEPARATION_RADIUS = 0.8f;
+	static constexpr f32 FAMILIAR_SEPARATION_ACCELERATION = 12.0f;
+	static constexpr i32 FAMILIAR_MAX_NEIGHBOURS = 16;
+	static constexpr f32 FAMILIAR_FOLLOW_DISTANCE = 1.5f; // ближе к видимому герою не подходят
+	static constexpr i32 FAMILIARS_COUNT = 6;
+	static constexpr v2<f32> COMPANION_DIM = { 0.4f, 0.4f };
+	static constexpr f32 COMPANION_SECONDS_PER_TILE = 0.15f;
+	static constexpr i32 COMPANION_FOLLOW_TILES = 2;  // ближе к герою не подходит
+	static constexpr i32 COMPANION_REPATH_TILES = 4;  // на столько герой отходит от цели пути, прежде чем спутник спросит новый
+	static constexpr i32 SIM_TICKS_PER_SECOND = 60;
+	static constexpr f32 SIM_TICK_DT = 1.0f / SIM_TICKS_PER_SECOND;
+	static constexpr i32 SIM_MAX_TICKS_PER_FRAME = 4; // при долгом кадре лишнее время теряем, иначе догоняющие тики только удлиняют кадры
+	static constexpr i32 SIM_ENTITIES_PER_JOB = 512;
+	static constexpr i32 STATE_HASH_INTERVAL_TICKS = 4;
+	static constexpr f32 SIM_REGION_RADIUS = SCENE_DIM_TILES.x * Tiles::TILE_DIM; // от камеры в центре сцены до дальнего края соседней
+	static constexpr u32 WORLD_GENERATOR_VERSION = 1; // менять вместе с генератором, иначе загрузится старый мир
+	static constexpr i32 WORLD_SCENES_COUNT = 100;
+	static constexpr i64 GENERATE_CHUNKS_PER_JOB = 16;
+	static constexpr i64 GENERATE_MAX_JOBS = 128;
+	static constexpr i32 GENERATE_NEAR_RADIUS_CHUNKS = 1; // вокруг героя и камеры генерируем сразу, не дожидаясь фона
+	static constexpr i64 GENERATE_BACKGROUND_CHUNKS_PER_JOB = 64;
+	static constexpr i32 GENERATE_BACKGROUND_MAX_JOBS = 2;
 
 	struct Controller_Button {
 		i32 transitions_count;
@@ -47,38 +80,133 @@ namespace Game {
 		i32 samples_per_second;
 	};
 
-	
-    struct Thread {};
+	namespace State_Hash_Block {
+		enum Type {
+			Sim,
+			Entity_Types,
+			Entity_Positions,
+			Entity_Prev_Positions,
+			Entity_Velocities,
+			Entity_Facings,
+			Entity_Chunk_Links,
+			Tiles_Versions,
+			Count
+		};
+	}
 
-    static slice<u8> read_file(Thread& thread, cstr file_name);
-    using Read_File = decltype(read_file);
+	namespace Phase {
+		enum Type {
+			World, // генератор и пейджер
+			Sim,
+			Pathfinder,
+			Render,
+			Count
+		};
+	}
 
-    static void write_file(Thread& thread, cstr file_name, slice<u8> file);
-    using Write_File = decltype(write_file);
+	// арены в отчёте платформы о памяти
+	namespace Arena_Id {
+		enum Type {
+			Permanent,
+			World,
+			Transient,
+			Frame_0,
+			Frame_1,
+			Count
+		};
+	}
 
-    static void free_file(Thread& thread, void*& memory);
-    using Free_File = decltype(free_file);
+	// хеш детерминированной части состояния, по отдельным блокам видно, где именно разошлось
+	struct State_Hash {
+		u64 tick;
+		u64 total;
+		Array<u64, State_Hash_Block::Count> blocks;
+	};
 
 	struct Memory {
 		bool is_initialized;
 		slice<u8> permanent;
 		slice<u8> transient;
-    	Read_File* read_file;
-    	Write_File* write_file;
-    	Free_File* free_file;
+		Work_Queue* high_priority_queue; // задачи текущего кадра, главный поток их дожидается
+		Work_Queue* low_priority_queue;  // фоновые задачи
+		Get_File_Size* get_file_size;
+		Read_File* read_file;
+		Write_File* write_file;
+		Map_File* map_file;
+		Unmap_File* unmap_file;
+		Open_File* open_file;
+		Open_File_For_Reading* open_file_for_reading;
+		Close_File* close_file;
+		Read_File_Block* read_file_block;
+		Write_File_Block* write_file_block;
+		Add_Work* add_work;
+		Complete_All_Work* complete_all_work;
+		bool is_headless; // без картинок и без записи файлов, для сервера и пакетных прогонов
+		bool is_world_in_memory; // для замеров: world.hmw не отображается, весь мир сразу генерируется в памяти игры
+		State_Hash state_hash; // игра обновляет раз в STATE_HASH_INTERVAL_TICKS тиков, платформа сверяет его при проигрывании реплея
+		Array<u64, Phase::Count> phase_cycles; // игра только прибавляет, платформа сама сбрасывает
+		Array<Arena*, Arena_Id::Count> arenas; // игра заполняет при инициализации, платформа только читает
+		i64 asset_cache_size; // бюджет кэша битмапов в transient, 0 = Assets::CACHE_DEFAULT_SIZE
+		Assets::Cache_Stats* asset_cache_stats; // игра заполняет при инициализации, платформа только читает. nullptr без отрисовки
 	};
 
 	struct Color {
 		f32 red, green, blue;
 	};
 
+	struct Scene_Layout {
+		bool is_present;
+		bool is_door_left, is_door_right;
+		bool is_door_top,  is_door_bottom;
+		bool is_stairs_up, is_stairs_down;
+	};
+
+	struct World;
+
+	struct Generate_Job {
+		World* world; // nullptr = свободна
+		slice<Tiles::Chunk_Lookup_Key> chunk_keys;
+		volatile bool is_done;
+	};
+
 	struct World {
 		Arena arena;
 		Tiles::Map tile_map;
+		slice<u8> file; // отображение world.hmw, чанки ссылаются прямо в него. Пустой, если мир сгенерирован
+		Tiles::Pager pager;
+		Paths::Pathfinder pathfinder;
+		Rays::Raycaster raycaster;
+		Entities::Storage entities;
+		slice3<Scene_Layout> scenes;
+		slice<Tiles::Chunk_Lookup_Key> pending_chunk_keys; // от ближних к герою к дальним
+		i64 next_pending_chunk;
+		Array<Generate_Job, GENERATE_BACKGROUND_MAX_JOBS> background_jobs;
+		bool is_save_needed;
+	};
+
+	// подряд идущие чанки области, каждая сущность читает только состояние начала тика и пишет только себя
+	struct Sim_Job {
+		Input* input;
+		Tiles::Map* map;
+		Paths::Flow_Field* flow_field;
+		Spatial::Grid* grid;
+		Entities::Sim_Region* region;
+		slice<bool> sees_hero; // по индексу в области, только у фамильяров
+		i32 hero_sim_index;
+		i32 first_sim_index;
+		i32 end_sim_index;
+	};
+
+	// спутник героя только для вида, ходит по тайлам по путям из очереди поиска. Пути ищутся в бюджете тактов кадра,
+	// поэтому спутник не входит ни в сущности, ни в хеш состояния и на симуляцию не влияет
+	struct Companion {
+		Tiles::Position pos;
+		Paths::Path* path; // nullptr = пора запросить новый
+		f32 step_time;
 	};
 
 	struct Hero_Side_Bitmap {
-		slice2<u32> head, cape, torso;
+		Assets::Asset_Id::Type head, cape, torso;
 		v2<i32> align;
 	};
 
@@ -94,57 +222,61 @@ namespace Game {
 
 	struct Game_State {
 		World world;
-		slice2<u32> background_bitmap;
+		Assets::Loader assets; // пак прямо из отображения файла, пустой если пак не собран
 		Array<Hero_Side_Bitmap, Hero_Direction::Count> hero_bitmaps;
-		Hero_Direction::Type hero_dir;
 		Tiles::Position camera_pos;
-		Tiles::Position hero_pos;
-		v2<f32> d_hero_pos;
+		i32 hero_index;
+		f32 sim_time_accumulator; // ещё не просимулированное время, меньше SIM_TICK_DT после кадра
+		u64 sim_tick;
+		Paths::Flow_Field hero_flow_field; // по нему к герою идёт толпа
+		Companion companion;
+		Arena permanent_arena;
+		Arena transient_arena;
+		Frame_Arena frame_arena; // весь transient кроме кэша битмапов, временные данные кадра берутся только отсюда
+		Array<Arena_Sites, Arena_Id::Count> arena_sites; // заполняются только в DEV_MODE
 		f32 pixels_per_unit;
 		f32 sound_t_sin;
 	};
 
-	#pragma pack(push, 1)
-	struct Bmp_Header {
-		// WINBMPFILEHEADER
-		u16 file_type;        /* File type, always 4D42h ("BM") */
-		u32 file_size;        /* Size of the file in bytes */
-		u16 reserved1;        /* Always 0 */
-		u16 reserved2;        /* Always 0 */
-		u32 bitmap_offset;    /* Starting position of image data in bytes */
-
-		// WIN3XBITMAPHEADER
-		u32 size;             /* Size of this header in bytes */
-		i32 width;            /* Image width in pixels */
-		i32 height;           /* Image height in pixels */
-		u16 planes;           /* Number of color planes */
-		u16 bits_per_pixel;   /* Number of bits per pixel */
-		u32 compression;      /* Compression methods used */
-		u32 size_of_bitmap;   /* Size of bitmap in bytes */
-		i32 horz_resolution;  /* Horizontal resolution in pixels per meter */
-		i32 vert_resolution;  /* Vertical resolution in pixels per meter */
-		u32 colors_used;      /* Number of colors in the image */
-		u32 colors_important; /* Minimum number of important colors */
-
-		// WINNTBITFIELDSMASKS
-		u32 red_mask;         /* Mask identifying bits of red component */
-		u32 green_mask;       /* Mask identifying bits of green component */
-		u32 blue_mask;        /* Mask identifying bits of blue component */
-	};
-	#pragma pack(pop)
-
-	extern "C" void update_and_render(Thread& thread, Input& input, Memory& memory, slice2<u32> screen);
-	using Update_And_Render = decltype(update_and_render);
+	// render рисует последнее состояние после simulate, сервер и пакетные прогоны зовут только simulate
+	extern "C" void simulate(Thread& thread, Input& input, Memory& memory);
+	using Simulate = decltype(simulate);
+	extern "C" void render(Thread& thread, Memory& memory, slice2<u32> screen);
+	using Render = decltype(render);
 	// get_sound_samples должен быть быстрым, не больше 1ms
 	extern "C" void get_sound_samples(Thread& thread, Memory& memory, Sound& sound);
 	using Get_Sound_Samples = decltype(get_sound_samples);
+	// только для замеров доступа к памяти мира, результат нужен лишь чтобы обход не выкинули
+	extern "C" u64 scan_world(Thread& thread, Memory& memory);
+	using Scan_World = decltype(scan_world);
+	// отпускает отображения мира и пака и файл пейджера. Фоновые задачи платформа дожидается до вызова,
+	// после него память игры больше не используется и платформа освобождает её сама
+	extern "C" void release_world(Thread& thread, Memory& memory);
+	using Release_World = decltype(release_world);
 
-	static slice2<u32> load_bmp(Thread& thread, Read_File* read_file, cstr file_name);
 	static void draw_pixels(slice2<u32> dst, slice2<u32> src, v2<f32> min_f32, v2<i32> align = {0, 0});
 	static void draw_rectangle(slice2<u32> dst, Color color, v2<f32> min_f32, v2<f32> max_f32);
 	static f32 get_pixels_per_unit(slice2<u32> screen);
 	static u32 get_hex_color(Color color);
 	
 	static void init_memory(Thread& thread, Memory& memory);
+	static void generate_world_layout(World& world);
+	static void sort_chunk_keys_by_distance(slice<Tiles::Chunk_Lookup_Key> keys, Tiles::Chunk_Lookup_Key center, Arena& scratch_arena);
+	static void update_world_generator(Thread& thread, Memory& memory, World& world, Arena& scratch_arena, Tiles::Position& camera_pos);
+	static void generate_chunks_around(Thread& thread, Memory& memory, World& world, Arena& scratch_arena, Tiles::Chunk_Lookup_Key center);
+	static void generate_all_chunks(Thread& thread, Memory& memory, World& world, Arena& scratch_arena);
+	static void generate_chunks(Thread& thread, Memory& memory, World& world, Arena& scratch_arena, slice<Tiles::Chunk_Lookup_Key> chunk_keys);
+	static void finish_generated_chunks(World& world, slice<Tiles::Chunk_Lookup_Key> chunk_keys);
+	static void do_generate_job(Thread& thread, void* data);
+	static void simulate_tick(Thread& thread, Input& input, Memory& memory, Game_State& game_state);
+	static void do_sim_job(Thread& thread, void* data);
+	static State_Hash get_state_hash(Game_State& game_state, Arena& scratch_arena);
+	static void update_hero(Input& input, Tiles::Map& map, Entities::Sim_Region& region, i32 sim_index, f32 dt);
+	static void update_familiar(Tiles::Map& map, Paths::Flow_Field& field, Spatial::Grid& grid, Entities::Sim_Region& region, i32 sim_index, i32 hero_sim_index, bool sees_hero, f32 dt);
+	static slice<bool> find_familiars_seeing_hero(Thread& thread, Arena& scratch_arena, Tiles::Map& map, Rays::Raycaster& raycaster, Entities::Sim_Region& region, i32 hero_sim_index);
+	static void move_entity(Tiles::Map& map, Entities::Sim_Region& region, i32 sim_index, v2<f32> dd_pos, f32 dt);
+	static void add_familiars(Tiles::Map& map, Entities::Storage& entities);
+	static void update_companion(Game_State& game_state, f32 dt);
+	static Tiles::Tile get_scene_tile(Scene_Layout& scene, i32 tile_x, i32 tile_y);
 	static Game_State& get_game_state(Memory& memory);
 }
\ No newline at end of file
@@ -261,21 +261,216 @@ struct slice {
     }
 };
 
+static constexpr i64 CACHE_LINE_SIZE = 64;
+static constexpr i64 PAGE_SIZE = 4_KB;
+
+// отметка, к которой арена откатывается в end_temp
+struct Arena_Temp {
+    i64 used;
+};
+
+// место вызова подставляет компилятор: cl умеет это с VS 2019 16.6. В более старых все push
+// записываются на строки этого файла, отчёт делится только по меткам
+#if defined(_MSC_VER) && !defined(__clang__) && _MSC_VER < 1926
+    #define CALLER_FUNCTION ""
+    #define CALLER_FILE     __FILE__
+    #define CALLER_LINE     __LINE__
+#else
+    #define CALLER_FUNCTION __builtin_FUNCTION()
+    #define CALLER_FILE     __builtin_FILE()
+    #define CALLER_LINE     __builtin_LINE()
+#endif
+
+static constexpr i32 ARENA_MAX_SITES = 64; // степень двойки
+static constexpr i32 ARENA_SITE_NAME_SIZE = 32;
+
+// все push с одного места вызова и с одной меткой. Имена копируются, чтобы пережить перезагрузку кода игры,
+// и ищутся по копиям, а не по указателям: после перезагрузки те же места находят свои старые записи
+struct Arena_Site {
+    i32 line;
+    i64 count;
+    i64 bytes;
+    Array<char, ARENA_SITE_NAME_SIZE> tag; // подсистема, которую назвал вызывающий, пустая если не назвал
+    Array<char, ARENA_SITE_NAME_SIZE> function;
+    Array<char, ARENA_SITE_NAME_SIZE> file;
+};
+
+// в DEV_MODE арена с такой таблицей записывает, кто сколько выделил с последнего clear
+struct Arena_Sites {
+    Array<Arena_Site, ARENA_MAX_SITES> sites; // открытая адресация по file, line и tag, пустой file = свободно
+    i64 lost_count; // не поместились в таблицу
+};
+
+// только имя файла без пути, обрезается по размеру
+static void copy_site_name(Array<char, ARENA_SITE_NAME_SIZE>& dst, cstr src) {
+    for (cstr c = src; *c; ++c) {
+        if (*c == '\\' || *c == '/') src = c + 1;
+    }
+    i32 length = 0;
+    while (src[length] && length < dst.get_count() - 1) {
+        dst(length) = src[length];
+        length += 1;
+    }
+    dst(length) = 0;
+}
+
+static bool is_same_site_name(Array<char, ARENA_SITE_NAME_SIZE>& a, Array<char, ARENA_SITE_NAME_SIZE>& b) {
+    for (i32 i = 0; i < a.get_count(); ++i) {
+        if (a(i) != b(i)) return false;
+        if (!a(i)) return true;
+    }
+    return true;
+}
+
+static u64 hash_site_name(u64 hash, Array<char, ARENA_SITE_NAME_SIZE>& name) {
+    for (i32 i = 0; name(i); ++i) hash = (hash ^ cast<u8>(name(i))) * 1099511628211ull;
+    return hash;
+}
+
 struct Arena {
     u8* ptr;
     i64 size;
     i64 used;
-
-    void clear() { used = 0; }
+    i64 max_used;
+    Arena_Sites* sites; // nullptr = места вызова не записываются
+
+    void clear() {
+        used = 0;
+        if (!sites) return;
+        for (auto& site : sites->sites) {
+            site.count = 0;
+            site.bytes = 0;
+        }
+        sites->lost_count = 0;
+    }
     
+    // align степень двойки, по умолчанию выравниваем по типу. Место вызова подставляет компилятор
     template <typename T>
-    T* push(i64 new_size) {
+    T* push(i64 new_size, i64 align = alignof(T), cstr tag = nullptr, cstr function = CALLER_FUNCTION, cstr file = CALLER_FILE, i32 line = CALLER_LINE) {
+        assert(align > 0 && (align & (align - 1)) == 0);
+        u64 address = (u64)(ptr + used);
+        used += cast<i64>((0 - address) & cast<u64>(align - 1));
         T* new_ptr = cast<T*>(ptr + used);
         used += new_size;
         assert(new_size % size_of(T) == 0);
         assert(used <= size);
+        if (used > max_used) max_used = used;
+        if constexpr (DEV_MODE) {
+            if (sites) record_site(new_size, tag, function, file, line);
+        }
         return new_ptr;
     }
+
+    // дочерняя арена живёт в памяти родителя, откат родителя её тоже освобождает
+    Arena push_arena(i64 new_size, i64 align = CACHE_LINE_SIZE, cstr tag = nullptr, cstr function = CALLER_FUNCTION, cstr file = CALLER_FILE, i32 line = CALLER_LINE) {
+        return { push<u8>(new_size, align, tag, function, file, line), new_size };
+    }
+
+    // всё выделенное после begin_temp освобождается в end_temp, обычно через defer
+    Arena_Temp begin_temp() { return { used }; }
+
+    void end_temp(Arena_Temp temp) {
+        assert(temp.used <= used);
+        used = temp.used;
+    }
+
+    void record_site(i64 new_size, cstr tag, cstr function, cstr file, i32 line) {
+        Array<char, ARENA_SITE_NAME_SIZE> file_name, tag_name;
+        copy_site_name(file_name, file);
+        copy_site_name(tag_name, tag ? tag : "");
+        u64 hash = hash_site_name(hash_site_name(14695981039346656037ull, file_name), tag_name) ^ cast<u64>(line);
+
+        for (i32 probe = 0; probe < ARENA_MAX_SITES; ++probe) {
+            auto& site = sites->sites(cast<i32>((hash + cast<u64>(probe)) & (ARENA_MAX_SITES - 1)));
+            if (!site.file(0)) {
+                site.line = line;
+                site.tag  = tag_name;
+                site.file = file_name;
+                copy_site_name(site.function, function);
+            }
+            if (site.line != line || !is_same_site_name(site.file, file_name) || !is_same_site_name(site.tag, tag_name)) continue;
+
+            site.count += 1;
+            site.bytes += new_size;
+            return;
+        }
+        sites->lost_count += 1;
+    }
+};
+
+// две половины по очереди: пока идёт кадр, данные прошлого кадра ещё целы
+struct Frame_Arena {
+    Array<Arena, 2> halves;
+    i32 current;
+
+    Arena& begin_frame() {
+        current ^= 1;
+        halves(current).clear();
+        return halves(current);
+    }
+
+    Arena& get_current()  { return halves(current); }
+    Arena& get_previous() { return halves(current ^ 1); }
+};
+
+static constexpr u8 POOL_POISON = 0xcd;
+
+struct Pool_Free_Block {
+    Pool_Free_Block* next;
+};
+
+// блоки одного размера, выделение и освобождение O(1). Свободные блоки связаны через собственную память,
+// в SLOW_MODE остальное содержимое свободного блока забивается POOL_POISON и проверяется при повторной выдаче
+template <typename T, i64 ALIGN = alignof(T)>
+struct Pool {
+    static_assert(sizeof(T) >= sizeof(Pool_Free_Block));
+
+    Pool_Free_Block* free_list;
+    Array<char, ARENA_SITE_NAME_SIZE> tag; // метка в отчёте о памяти для всех блоков пула, копия переживает перезагрузку кода
+    i64 max_count;       // 0 = без ограничения
+    i64 allocated_count; // взято из арены
+    i64 free_count;
+
+    // только из free list, nullptr если он пуст
+    T* alloc() {
+        auto* block = free_list;
+        if (!block) return nullptr;
+        free_list = block->next;
+        free_count -= 1;
+#if SLOW_MODE
+        u8* bytes = cast<u8*>(block);
+        for (i64 i = size_of(Pool_Free_Block); i < size_of(T); ++i) assert(bytes[i] == POOL_POISON && "write after free");
+#endif
+        return cast<T*>(block);
+    }
+
+    T* alloc(Arena& arena, cstr function = CALLER_FUNCTION, cstr file = CALLER_FILE, i32 line = CALLER_LINE) {
+        if (free_list) return alloc();
+        return push_new(arena, function, file, line);
+    }
+
+    void free(T* item) {
+        assert(item);
+#if SLOW_MODE
+        u8* bytes = cast<u8*>(item);
+        for (i64 i = size_of(Pool_Free_Block); i < size_of(T); ++i) bytes[i] = POOL_POISON;
+#endif
+        auto* block = cast<Pool_Free_Block*>(item);
+        block->next = free_list;
+        free_list = block;
+        free_count += 1;
+    }
+
+    // выделяем всё заранее, дальше хватает alloc() без арены
+    void reserve(Arena& arena, i64 count, cstr function = CALLER_FUNCTION, cstr file = CALLER_FILE, i32 line = CALLER_LINE) {
+        for (i64 i = 0; i < count; ++i) free(push_new(arena, function, file, line));
+    }
+
+    T* push_new(Arena& arena, cstr function, cstr file, i32 line) {
+        assert_or_return(!max_count || allocated_count < max_count);
+        allocated_count += 1;
+        return arena.push<T>(size_of(T), ALIGN, tag.ptr, function, file, line);
+    }
 };
 
 template <typename T>
@@ -128,6 +128,69 @@ namespace hm {
     //     }
     // }
 
+    static u64 rotate_left(u64 value, i32 shift) {
+        if constexpr (MSVC_COMPILER) {
+            return _rotl64(value, shift);
+        } else {
+            return (value << shift) | (value >> (64 - shift));
+        }
+    }
+
+    static u64 read_cycle_counter() {
+        return __rdtsc();
+    }
+
+    // по схеме xxHash64: четыре независимые полосы по 32 байта, потом хвост и перемешивание
+    static u64 hash_bytes(slice<u8> bytes, u64 seed = 0) {
+        static constexpr u64 PRIME_1 = 11400714785074694791ull;
+        static constexpr u64 PRIME_2 = 14029467366897019727ull;
+        static constexpr u64 PRIME_3 = 1609587929392839161ull;
+        static constexpr u64 PRIME_4 = 9650029242287828579ull;
+        static constexpr u64 PRIME_5 = 2870177450012600261ull;
+        auto round = [](u64 acc, u64 input) { return rotate_left(acc + input * PRIME_2, 31) * PRIME_1; };
+        auto merge = [round](u64 hash, u64 acc) { return (hash ^ round(0, acc)) * PRIME_1 + PRIME_4; };
+
+        u8* ptr = bytes.ptr;
+        u8* end = bytes.ptr + bytes.count;
+        u64 hash = seed + PRIME_5;
+
+        if (bytes.count >= 32) {
+            u64 lanes[4] = { seed + PRIME_1 + PRIME_2, seed + PRIME_2, seed, seed - PRIME_1 };
+            for (; ptr + 32 <= end; ptr += 32) {
+                for (i32 lane = 0; lane < 4; ++lane) {
+                    u64 input;
+                    memcpy(&input, ptr + lane * 8, 8);
+                    lanes[lane] = round(lanes[lane], input);
+                }
+            }
+            hash = rotate_left(lanes[0], 1) + rotate_left(lanes[1], 7) + rotate_left(lanes[2], 12) + rotate_left(lanes[3], 18);
+            for (u64 lane : lanes) hash = merge(hash, lane);
+        }
+        hash += cast<u64>(bytes.count);
+
+        for (; ptr + 8 <= end; ptr += 8) {
+            u64 input;
+            memcpy(&input, ptr, 8);
+            hash = rotate_left(hash ^ round(0, input), 27) * PRIME_1 + PRIME_4;
+        }
+        if (ptr + 4 <= end) {
+            u32 input;
+            memcpy(&input, ptr, 4);
+            hash = rotate_left(hash ^ (input * PRIME_1), 23) * PRIME_2 + PRIME_3;
+            ptr += 4;
+        }
+        for (; ptr < end; ++ptr) {
+            hash = rotate_left(hash ^ (*ptr * PRIME_5), 11) * PRIME_1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME_2;
+        hash ^= hash >> 29;
+        hash *= PRIME_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
     static result<i32> find_set_bit_right(u32 value) {
         if constexpr (MSVC_COMPILER) {
             result<i32> result = {};
@@ -0,0 +1,706 @@
+#include "intrinsics.hpp"
+#include "paths.hpp"
+
+namespace Paths {
+	static void init_pathfinder(Arena& world_arena, Tiles::Map& map, Pathfinder& pathfinder) {
+		auto& graphs = pathfinder.graphs;
+		graphs.count_x = map.chunks.count_x;
+		graphs.count_y = map.chunks.count_y;
+		graphs.count_z = map.chunks.count_z;
+		graphs.ptr = world_arena.push<Chunk_Graph*>(graphs.get_size(), alignof(Chunk_Graph*), "paths");
+
+		// пути берутся из арены по мере запросов, заранее только очередь.
+		// Путь стоит в очереди не больше одного раза и освобождается не раньше, чем его из неё заберут
+		copy_site_name(pathfinder.path_pool.tag, "paths");
+		pathfinder.path_pool.max_count = MAX_PATHS;
+		pathfinder.queue.count = MAX_PATHS;
+		pathfinder.queue.ptr = world_arena.push<Path*>(pathfinder.queue.get_size(), alignof(Path*), "paths");
+	}
+
+	// путь ищется в update_pathfinder, до этого state == Queued
+	static Path* request_path(Arena& world_arena, Pathfinder& pathfinder, Tiles::Position& start, Tiles::Position& goal) {
+		auto* path = pathfinder.path_pool.alloc(world_arena);
+		assert_or_return(path);
+		assert(pathfinder.queue_write - pathfinder.queue_read < pathfinder.queue.count);
+
+		*path = {};
+		path->state = Path_State::Queued;
+		path->start = get_path_point(start);
+		path->goal  = get_path_point(goal);
+
+		pathfinder.queue(pathfinder.queue_write % pathfinder.queue.count) = path;
+		pathfinder.queue_write += 1;
+		return path;
+	}
+
+	static void release_path(Pathfinder& pathfinder, Path* path) {
+		// очередь не должна читать освобождённый блок, такой путь вернёт в пул update_pathfinder
+		if (path->state == Path_State::Queued) {
+			path->state = Path_State::Released;
+			return;
+		}
+		pathfinder.path_pool.free(path);
+	}
+
+	static void update_pathfinder(Arena& world_arena, Arena& scratch_arena, Tiles::Map& map, Pathfinder& pathfinder) {
+		u64 start_cycles = hm::read_cycle_counter();
+		while (pathfinder.queue_read < pathfinder.queue_write && hm::read_cycle_counter() - start_cycles < PATHFINDER_CYCLES_PER_FRAME) {
+			auto& path = *pathfinder.queue(pathfinder.queue_read % pathfinder.queue.count);
+			pathfinder.queue_read += 1;
+			if (path.state == Path_State::Released) {
+				pathfinder.path_pool.free(&path); // освободили раньше, чем до него дошла очередь
+				continue;
+			}
+
+			auto temp = scratch_arena.begin_temp();
+			find_path(world_arena, scratch_arena, map, pathfinder, path);
+			scratch_arena.end_temp(temp);
+		}
+	}
+
+	// направление на соседний тайл, {0, 0} если путь пройден или потерян
+	static v2<i32> get_path_step(Pathfinder& pathfinder, Tiles::Map& map, Path& path, Tiles::Position& pos) {
+		if (path.state != Path_State::Found) return {};
+
+		// лестница переносит на другой этаж в тот же тайл, поэтому этаж не сравниваем
+		auto point = get_path_point(pos);
+		while (path.next_waypoint < path.waypoints_count && path.waypoints(path.next_waypoint).abs_xy == point.abs_xy) {
+			path.next_waypoint += 1;
+		}
+		if (path.next_waypoint == path.waypoints_count) return {};
+
+		auto& target = path.waypoints(path.next_waypoint);
+		auto key        = Tiles::get_chunk_lookup_key(point.abs_xy.x,  point.abs_xy.y,  point.abs_z);
+		auto target_key = Tiles::get_chunk_lookup_key(target.abs_xy.x, target.abs_xy.y, target.abs_z);
+		if (!check_same_chunk(key, target_key)) {
+			v2<i32> diff = target.abs_xy - point.abs_xy;
+			if (target.abs_z == point.abs_z && hm::abs(diff.x) + hm::abs(diff.y) == 1) return diff;
+			return {}; // сбились с пути, нужен новый запрос
+		}
+
+		auto target_rel = Tiles::get_chunk_rel_position(target.abs_xy.x, target.abs_xy.y);
+		Array<u8, Tiles::CHUNK_TILES_COUNT>* distances = nullptr;
+		if (path.next_waypoint == path.waypoints_count - 1) {
+			distances = &path.goal_distances;
+		} else {
+			auto* graph = pathfinder.graphs(key.x, key.y, key.z);
+			if (!graph) return {};
+
+			// у узлов на одном тайле одинаковые расстояния
+			for (i32 node_index = 0; node_index < graph->nodes_count; ++node_index) {
+				auto& node = graph->nodes(node_index);
+				if (node.chunk_rel == target_rel) distances = &node.distances;
+			}
+			if (!distances) return {};
+		}
+
+		auto rel = Tiles::get_chunk_rel_position(point.abs_xy.x, point.abs_xy.y);
+		i32 step_index = get_descent_step(map.chunks(key.x, key.y, key.z), *distances, rel, target_rel);
+		return step_index >= 0 ? NEIGHBOUR_STEPS[step_index] : v2<i32>{};
+	}
+
+	static void init_flow_field(Arena& world_arena, Tiles::Map& map, Flow_Field& field) {
+		field.chunks.count_x = 2 * FLOW_RADIUS_CHUNKS + 1;
+		field.chunks.count_y = 2 * FLOW_RADIUS_CHUNKS + 1;
+		field.chunks.count_z = map.chunks.count_z;
+		field.chunks.ptr = world_arena.push<Flow_Chunk>(field.chunks.get_size(), alignof(Flow_Chunk), "paths");
+	}
+
+	// пересчёт только когда цель сменила тайл или перестроился граф. Стоимости выходов по графу узлов считаются заново, это дёшево.
+	// Если цель осталась в своём чанке, тайловые поля остальных чанков сохраняются, где все их выходы сдвинулись на одно и то же
+	static void update_flow_field(Arena& world_arena, Arena& scratch_arena, Tiles::Map& map, Pathfinder& pathfinder, Flow_Field& field, Tiles::Position& target) {
+		auto target_point = get_path_point(target);
+		auto target_key = Tiles::get_chunk_lookup_key(target_point.abs_xy.x, target_point.abs_xy.y, target_point.abs_z);
+		Tiles::Chunk_Lookup_Key region_min = { target_key.x - FLOW_RADIUS_CHUNKS, target_key.y - FLOW_RADIUS_CHUNKS, 0 };
+
+		// графы строятся до сравнения, чтобы заметить их перестройку
+		for (        i32 z = 0; z < field.chunks.count_z; ++z) {
+			for (    i32 y = 0; y < field.chunks.count_y; ++y) {
+				for (i32 x = 0; x < field.chunks.count_x; ++x) {
+					Tiles::Chunk_Lookup_Key key = { region_min.x + x, region_min.y + y, z };
+					bool is_in_world = key.x >= 0 && key.x < map.chunks.count_x && key.y >= 0 && key.y < map.chunks.count_y;
+					field.chunks(x, y, z).graph = is_in_world ? get_chunk_graph(world_arena, map, pathfinder, key) : nullptr;
+				}
+			}
+		}
+
+		if (field.is_valid && field.graphs_version == pathfinder.graphs_version &&
+		    field.target.abs_xy == target_point.abs_xy && field.target.abs_z == target_point.abs_z) return;
+
+		auto old_target_key = Tiles::get_chunk_lookup_key(field.target.abs_xy.x, field.target.abs_xy.y, field.target.abs_z);
+		bool is_same_target_chunk = field.is_valid && field.graphs_version == pathfinder.graphs_version && check_same_chunk(old_target_key, target_key);
+
+		// старые стоимости нужны для сравнения после пересчёта, берутся из scratch до кучи
+		slice<Array<u16, CHUNK_MAX_NODES>> old_exit_costs = {};
+		if (is_same_target_chunk) {
+			old_exit_costs.count = field.chunks.count_x * field.chunks.count_y * field.chunks.count_z;
+			old_exit_costs.ptr = scratch_arena.push<Array<u16, CHUNK_MAX_NODES>>(old_exit_costs.get_size());
+			for (i64 i = 0; i < old_exit_costs.count; ++i) old_exit_costs(i) = field.chunks.ptr[i].exit_costs;
+		}
+
+		field.target = target_point;
+		field.region_min = region_min;
+		field.graphs_version = pathfinder.graphs_version;
+		field.is_valid = true;
+		for (auto& flow_chunk : field.chunks) {
+			for (auto& exit_cost : flow_chunk.exit_costs) exit_cost = FLOW_UNREACHABLE;
+			if (!is_same_target_chunk) flow_chunk.is_filled = false;
+		}
+
+		auto* target_flow_chunk = get_flow_chunk(field, target_key);
+		target_flow_chunk->is_filled = false;
+
+		auto* target_chunk = Tiles::get_chunk(map, target_point.abs_xy.x, target_point.abs_xy.y, target_point.abs_z);
+		if (!target_chunk || !check_chunk_readable(map, target_key)) {
+			for (auto& distance : field.goal_distances) distance = UNREACHABLE;
+			for (auto& flow_chunk : field.chunks) flow_chunk.is_filled = false;
+			return;
+		}
+		fill_distances(*target_chunk, Tiles::get_chunk_rel_position(target_point.abs_xy.x, target_point.abs_xy.y), field.goal_distances);
+
+		// обратный Дейкстра по узлам: стоимость выхода из узла через его связь до цели
+		struct Open_Node {
+			i32 cost;
+			Flow_Chunk* flow_chunk;
+			i32 index;
+		};
+		// куча растёт в scratch по мере надобности, пока она строится, из scratch больше ничего не берётся
+		slice<Open_Node> open = {};
+		open.ptr = scratch_arena.push<Open_Node>(0);
+		i64 open_capacity = 0;
+
+		auto push_open = [&](Open_Node open_node) {
+			if (open.count == open_capacity) {
+				scratch_arena.push<Open_Node>(size_of(Open_Node));
+				open_capacity += 1;
+			}
+			i64 index = open.count;
+			open.count += 1;
+			while (index > 0 && open((index - 1) / 2).cost > open_node.cost) {
+				open(index) = open((index - 1) / 2);
+				index = (index - 1) / 2;
+			}
+			open(index) = open_node;
+		};
+		auto pop_open = [&]() {
+			Open_Node top = open(0);
+			Open_Node last = open(open.count - 1);
+			open.count -= 1;
+
+			i64 index = 0;
+			while (2 * index + 1 < open.count) {
+				i64 child = 2 * index + 1;
+				if (child + 1 < open.count && open(child + 1).cost < open(child).cost) child += 1;
+				if (open(child).cost >= last.cost) break;
+				open(index) = open(child);
+				index = child;
+			}
+			if (open.count) open(index) = last;
+			return top;
+		};
+		// в узел приходят по связи из узла-партнёра, у него и появляется новая стоимость выхода
+		auto push_partner = [&](Flow_Chunk& flow_chunk, i32 node_index, i32 cost) {
+			auto& graph = *flow_chunk.graph;
+			auto& node = graph.nodes(node_index);
+			v2<i32> chunk_min = { graph.key.x << Tiles::CHUNK_LOOKUP_KEY_SHIFT, graph.key.y << Tiles::CHUNK_LOOKUP_KEY_SHIFT };
+			v2<i32> link_xy = chunk_min + node.chunk_rel + v2<i32>{ node.link.x, node.link.y };
+			i32 link_z = graph.key.z + node.link.z;
+			if (link_z < 0 || link_z >= map.chunks.count_z) return;
+
+			auto* partner_chunk = get_flow_chunk(field, Tiles::get_chunk_lookup_key(link_xy.x, link_xy.y, link_z));
+			if (!partner_chunk || !partner_chunk->graph) return;
+
+			auto link_rel = Tiles::get_chunk_rel_position(link_xy.x, link_xy.y);
+			i32 partner_index = find_node(*partner_chunk->graph, link_rel, { -node.link.x, -node.link.y, -node.link.z });
+			if (partner_index >= 0) push_open({ cost + 1, partner_chunk, partner_index });
+		};
+
+		if (target_flow_chunk->graph) {
+			auto& graph = *target_flow_chunk->graph;
+			for (i32 node_index = 0; node_index < graph.nodes_count; ++node_index) {
+				u8 distance = field.goal_distances(get_tile_index(graph.nodes(node_index).chunk_rel));
+				if (distance != UNREACHABLE) push_partner(*target_flow_chunk, node_index, distance);
+			}
+		}
+
+		while (open.count) {
+			auto open_node = pop_open();
+			auto& flow_chunk = *open_node.flow_chunk;
+			auto& exit_cost = flow_chunk.exit_costs(open_node.index);
+			if (exit_cost != FLOW_UNREACHABLE) continue;
+			if (open_node.cost >= FLOW_UNREACHABLE) break;
+			exit_cost = cast<u16>(open_node.cost);
+
+			auto& graph = *flow_chunk.graph;
+			i32 exit_tile_index = get_tile_index(graph.nodes(open_node.index).chunk_rel);
+			for (i32 node_index = 0; node_index < graph.nodes_count; ++node_index) {
+				if (node_index == open_node.index) continue;
+
+				u8 distance = graph.nodes(node_index).distances(exit_tile_index);
+				if (distance != UNREACHABLE) push_partner(flow_chunk, node_index, open_node.cost + distance);
+			}
+		}
+
+		for (i64 i = 0; i < old_exit_costs.count; ++i) {
+			auto& flow_chunk = field.chunks.ptr[i];
+			if (flow_chunk.is_filled && !shift_flow_chunk(flow_chunk, old_exit_costs(i))) flow_chunk.is_filled = false;
+		}
+	}
+
+	// выбор выхода не меняется, если все достижимые выходы подорожали или подешевели на одно и то же.
+	// Тогда интеграция сдвигается на эту разницу, направления остаются. false = чанк надо заполнить заново
+	static bool shift_flow_chunk(Flow_Chunk& flow_chunk, Array<u16, CHUNK_MAX_NODES>& old_exit_costs) {
+		i32 delta = 0;
+		bool is_delta_found = false;
+		for (i32 node_index = 0; node_index < flow_chunk.graph->nodes_count; ++node_index) {
+			u16 old_cost = old_exit_costs(node_index);
+			u16 new_cost = flow_chunk.exit_costs(node_index);
+			if ((old_cost == FLOW_UNREACHABLE) != (new_cost == FLOW_UNREACHABLE)) return false;
+			if (new_cost == FLOW_UNREACHABLE) continue;
+
+			if (is_delta_found && new_cost - old_cost != delta) return false;
+			delta = new_cost - old_cost;
+			is_delta_found = true;
+		}
+		if (!delta) return true;
+
+		for (auto& cost : flow_chunk.integration) {
+			if (cost == FLOW_UNREACHABLE) continue;
+			if (cost + delta >= FLOW_UNREACHABLE) return false;
+			cost = cast<u16>(cost + delta);
+		}
+		return true;
+	}
+
+	// одно обращение на агента, тайловое поле чанка считается один раз на всех
+	static v2<i32> get_flow_step(Tiles::Map& map, Flow_Field& field, Tiles::Position& pos) {
+		if (!field.is_valid) return {};
+
+		auto* flow_chunk = get_flow_chunk(field, Tiles::get_chunk_lookup_key(pos.abs_xy.x, pos.abs_xy.y, pos.abs_z));
+		if (!flow_chunk || !flow_chunk->graph) return {};
+		if (!flow_chunk->is_filled) fill_flow_chunk(map, field, *flow_chunk);
+
+		u8 direction = flow_chunk->directions(get_tile_index(Tiles::get_chunk_rel_position(pos.abs_xy.x, pos.abs_xy.y)));
+		return direction ? NEIGHBOUR_STEPS[direction - 1] : v2<i32>{};
+	}
+
+	// заполняет поле чанка заранее, после этого get_flow_step в нём только читает и его можно звать из потоков
+	static void prepare_flow_chunk(Tiles::Map& map, Flow_Field& field, Tiles::Chunk_Lookup_Key key) {
+		if (!field.is_valid) return;
+
+		auto* flow_chunk = get_flow_chunk(field, key);
+		if (flow_chunk && flow_chunk->graph && !flow_chunk->is_filled) fill_flow_chunk(map, field, *flow_chunk);
+	}
+
+	static void fill_flow_chunk(Tiles::Map& map, Flow_Field& field, Flow_Chunk& flow_chunk) {
+		auto& graph = *flow_chunk.graph;
+		auto& chunk = map.chunks(graph.key.x, graph.key.y, graph.key.z);
+		auto target_key = Tiles::get_chunk_lookup_key(field.target.abs_xy.x, field.target.abs_xy.y, field.target.abs_z);
+		auto target_rel = Tiles::get_chunk_rel_position(field.target.abs_xy.x, field.target.abs_xy.y);
+		bool is_target_chunk = check_same_chunk(graph.key, target_key);
+		flow_chunk.is_filled = true;
+
+		for (    i32 y = 0; y < Tiles::CHUNK_DIM_TILES; ++y) {
+			for (i32 x = 0; x < Tiles::CHUNK_DIM_TILES; ++x) {
+				v2<i32> rel = { x, y };
+				i32 tile_index = get_tile_index(rel);
+
+				i32 best_cost = FLOW_UNREACHABLE;
+				i32 best_node = -1;
+				if (is_target_chunk && field.goal_distances(tile_index) != UNREACHABLE) best_cost = field.goal_distances(tile_index);
+
+				for (i32 node_index = 0; node_index < graph.nodes_count; ++node_index) {
+					auto& node = graph.nodes(node_index);
+					u8 distance = node.distances(tile_index);
+					if (flow_chunk.exit_costs(node_index) == FLOW_UNREACHABLE || distance == UNREACHABLE) continue;
+					if (node.link.z && !distance) continue; // стоящего на лестнице она уже перенесла
+
+					i32 cost = distance + flow_chunk.exit_costs(node_index);
+					if (cost < best_cost) {
+						best_cost = cost;
+						best_node = node_index;
+					}
+				}
+
+				flow_chunk.integration(tile_index) = cast<u16>(best_cost);
+				flow_chunk.directions(tile_index) = 0;
+				if (best_cost == FLOW_UNREACHABLE) continue;
+
+				i32 step_index = -1;
+				if (best_node < 0) {
+					step_index = get_descent_step(chunk, field.goal_distances, rel, target_rel);
+				} else {
+					auto& node = graph.nodes(best_node);
+					if (!node.distances(tile_index)) {
+						for (i32 i = 0; i < 4; ++i) {
+							if (NEIGHBOUR_STEPS[i] == v2<i32>{ node.link.x, node.link.y }) step_index = i;
+						}
+					} else {
+						step_index = get_descent_step(chunk, node.distances, rel, node.chunk_rel);
+					}
+				}
+				flow_chunk.directions(tile_index) = cast<u8>(step_index + 1);
+			}
+		}
+	}
+
+	static Flow_Chunk* get_flow_chunk(Flow_Field& field, Tiles::Chunk_Lookup_Key key) {
+		v2<i32> region_rel = { key.x - field.region_min.x, key.y - field.region_min.y };
+		if (region_rel.x < 0 || region_rel.x >= field.chunks.count_x ||
+		    region_rel.y < 0 || region_rel.y >= field.chunks.count_y) return nullptr;
+		return &field.chunks(region_rel.x, region_rel.y, key.z);
+	}
+
+	static void find_path(Arena& world_arena, Arena& scratch_arena, Tiles::Map& map, Pathfinder& pathfinder, Path& path) {
+		path.state = Path_State::Not_Found;
+
+		auto start_key = Tiles::get_chunk_lookup_key(path.start.abs_xy.x, path.start.abs_xy.y, path.start.abs_z);
+		auto goal_key  = Tiles::get_chunk_lookup_key(path.goal.abs_xy.x,  path.goal.abs_xy.y,  path.goal.abs_z);
+		auto* start_chunk = Tiles::get_chunk(map, path.start.abs_xy.x, path.start.abs_xy.y, path.start.abs_z);
+		auto* goal_chunk  = Tiles::get_chunk(map, path.goal.abs_xy.x,  path.goal.abs_xy.y,  path.goal.abs_z);
+		if (!start_chunk || !goal_chunk || !check_chunk_readable(map, goal_key)) return;
+
+		auto start_rel = Tiles::get_chunk_rel_position(path.start.abs_xy.x, path.start.abs_xy.y);
+		auto goal_rel  = Tiles::get_chunk_rel_position(path.goal.abs_xy.x,  path.goal.abs_xy.y);
+		fill_distances(*goal_chunk, goal_rel, path.goal_distances);
+
+		// внутри одного чанка граф не нужен
+		if (check_same_chunk(start_key, goal_key) && path.goal_distances(get_tile_index(start_rel)) != UNREACHABLE) {
+			path.waypoints(0) = path.goal;
+			path.waypoints_count = 1;
+			path.state = Path_State::Found;
+			return;
+		}
+
+		auto* start_graph = get_chunk_graph(world_arena, map, pathfinder, start_key);
+		if (!start_graph) return;
+
+		struct Open_Node {
+			i32 priority;
+			i32 cost;
+			Node_Ref node;
+			Node_Ref parent;
+		};
+		slice<Open_Node> open = {};
+		open.ptr = scratch_arena.push<Open_Node>((MAX_EXPANSIONS_PER_QUERY + 1) * (CHUNK_MAX_NODES + 2) * size_of(Open_Node));
+
+		auto push_open = [&](Open_Node open_node) {
+			i64 index = open.count;
+			open.count += 1;
+			while (index > 0 && open((index - 1) / 2).priority > open_node.priority) {
+				open(index) = open((index - 1) / 2);
+				index = (index - 1) / 2;
+			}
+			open(index) = open_node;
+		};
+		auto pop_open = [&]() {
+			Open_Node top = open(0);
+			Open_Node last = open(open.count - 1);
+			open.count -= 1;
+
+			i64 index = 0;
+			while (2 * index + 1 < open.count) {
+				i64 child = 2 * index + 1;
+				if (child + 1 < open.count && open(child + 1).priority < open(child).priority) child += 1;
+				if (open(child).priority >= last.priority) break;
+				open(index) = open(child);
+				index = child;
+			}
+			if (open.count) open(index) = last;
+			return top;
+		};
+		auto get_node_point = [](Node_Ref ref) -> Path_Point {
+			auto& node = ref.graph->nodes(ref.index);
+			v2<i32> chunk_min = { ref.graph->key.x << Tiles::CHUNK_LOOKUP_KEY_SHIFT, ref.graph->key.y << Tiles::CHUNK_LOOKUP_KEY_SHIFT };
+			return { chunk_min + node.chunk_rel, ref.graph->key.z };
+		};
+		auto get_heuristic = [&](Path_Point point) {
+			v2<i32> diff = path.goal.abs_xy - point.abs_xy;
+			return hm::abs(diff.x) + hm::abs(diff.y) + hm::abs(path.goal.abs_z - point.abs_z);
+		};
+
+		pathfinder.search_index += 1;
+		for (i32 node_index = 0; node_index < start_graph->nodes_count; ++node_index) {
+			Node_Ref ref = { start_graph, node_index };
+			u8 distance = start_graph->nodes(node_index).distances(get_tile_index(start_rel));
+			if (distance != UNREACHABLE) push_open({ distance + get_heuristic(get_node_point(ref)), distance, ref, {} });
+		}
+
+		i32 expansions_count = 0;
+		while (open.count && expansions_count < MAX_EXPANSIONS_PER_QUERY) {
+			auto open_node = pop_open();
+
+			if (!open_node.node.graph) {
+				i32 waypoints_count = 1;
+				for (auto ref = open_node.parent; ref.graph; ref = ref.graph->nodes(ref.index).parent) waypoints_count += 1;
+				if (waypoints_count > MAX_WAYPOINTS) return; // LATER: отдавать начало пути и дописывать по мере прохождения
+
+				path.waypoints_count = waypoints_count;
+				path.waypoints(waypoints_count - 1) = path.goal;
+				i32 waypoint_index = waypoints_count - 2;
+				for (auto ref = open_node.parent; ref.graph; ref = ref.graph->nodes(ref.index).parent) {
+					path.waypoints(waypoint_index) = get_node_point(ref);
+					waypoint_index -= 1;
+				}
+				path.state = Path_State::Found;
+				return;
+			}
+
+			auto& graph = *open_node.node.graph;
+			auto& node  = graph.nodes(open_node.node.index);
+			if (node.search_index == pathfinder.search_index && node.is_closed) continue;
+
+			node.search_index = pathfinder.search_index;
+			node.is_closed = true;
+			node.cost = open_node.cost;
+			node.parent = open_node.parent;
+			expansions_count += 1;
+
+			// на лестницу пришли пешком, значит она переносит на другой этаж и дальше только по связи
+			bool is_linked_arrival = open_node.parent.graph
+				? open_node.parent.graph != &graph
+				: bool(node.chunk_rel == start_rel);
+			bool is_passing_stairs = node.link.z && !is_linked_arrival;
+
+			i32 node_tile_index = get_tile_index(node.chunk_rel);
+			if (check_same_chunk(graph.key, goal_key) && !is_passing_stairs) {
+				u8 distance = path.goal_distances(node_tile_index);
+				if (distance != UNREACHABLE) push_open({ node.cost + distance, node.cost + distance, {}, open_node.node });
+			}
+
+			for (i32 other_index = 0; other_index < graph.nodes_count && !is_passing_stairs; ++other_index) {
+				auto& other = graph.nodes(other_index);
+				if (other.search_index == pathfinder.search_index && other.is_closed) continue;
+
+				u8 distance = other.distances(node_tile_index);
+				if (distance == UNREACHABLE) continue;
+
+				Node_Ref other_ref = { &graph, other_index };
+				push_open({ node.cost + distance + get_heuristic(get_node_point(other_ref)), node.cost + distance, other_ref, open_node.node });
+			}
+
+			// переход через границу чанка или по лестнице
+			auto point = get_node_point(open_node.node);
+			Path_Point link_point = { point.abs_xy + v2<i32>{ node.link.x, node.link.y }, point.abs_z + node.link.z };
+			if (!Tiles::get_chunk(map, link_point.abs_xy.x, link_point.abs_xy.y, link_point.abs_z)) continue;
+
+			auto link_key = Tiles::get_chunk_lookup_key(link_point.abs_xy.x, link_point.abs_xy.y, link_point.abs_z);
+			auto* link_graph = get_chunk_graph(world_arena, map, pathfinder, link_key);
+			if (!link_graph) continue;
+
+			auto link_rel = Tiles::get_chunk_rel_position(link_point.abs_xy.x, link_point.abs_xy.y);
+			i32 link_index = find_node(*link_graph, link_rel, { -node.link.x, -node.link.y, -node.link.z });
+			if (link_index < 0) continue;
+
+			auto& link_node = link_graph->nodes(link_index);
+			if (link_node.search_index == pathfinder.search_index && link_node.is_closed) continue;
+			push_open({ node.cost + 1 + get_heuristic(link_point), node.cost + 1, { link_graph, link_index }, open_node.node });
+		}
+	}
+
+	// граф перестраивается, когда изменились тайлы чанка или соседей. Пока кто-то из них не в памяти, остаётся старый граф
+	static Chunk_Graph* get_chunk_graph(Arena& world_arena, Tiles::Map& map, Pathfinder& pathfinder, Tiles::Chunk_Lookup_Key key) {
+		auto& graph = pathfinder.graphs(key.x, key.y, key.z);
+		auto tiles_versions = get_tiles_versions(map, key);
+
+		if (graph) {
+			bool is_same_versions = true;
+			for (i32 i = 0; i < tiles_versions.get_count(); ++i) {
+				if (graph->tiles_versions(i) != tiles_versions(i)) is_same_versions = false;
+			}
+			if (is_same_versions) return graph;
+		}
+
+		if (!check_chunk_readable(map, key) ||
+		    !check_chunk_readable(map, { key.x - 1, key.y, key.z }) || !check_chunk_readable(map, { key.x + 1, key.y, key.z }) ||
+		    !check_chunk_readable(map, { key.x, key.y - 1, key.z }) || !check_chunk_readable(map, { key.x, key.y + 1, key.z })) {
+			return graph;
+		}
+
+		if (!graph) {
+			if (!map.chunks(key.x, key.y, key.z).tiles) return nullptr; // пустой чанк непроходим
+			graph = world_arena.push<Chunk_Graph>(size_of(Chunk_Graph), alignof(Chunk_Graph), "paths");
+		}
+
+		pathfinder.graphs_version += 1;
+		graph->key = key;
+		graph->tiles_versions = tiles_versions;
+		build_chunk_graph(map, *graph);
+		return graph;
+	}
+
+	static void build_chunk_graph(Tiles::Map& map, Chunk_Graph& graph) {
+		auto& key = graph.key;
+		auto& chunk = map.chunks(key.x, key.y, key.z);
+		graph.nodes_count = 0;
+		if (!chunk.tiles) return;
+
+		add_border_nodes(map, graph, { -1,  0 });
+		add_border_nodes(map, graph, {  1,  0 });
+		add_border_nodes(map, graph, {  0, -1 });
+		add_border_nodes(map, graph, {  0,  1 });
+
+		// лестница ведёт на соседний этаж в тот же тайл
+		for (    i32 y = 0; y < Tiles::CHUNK_DIM_TILES; ++y) {
+			for (i32 x = 0; x < Tiles::CHUNK_DIM_TILES; ++x) {
+				auto tile = (*chunk.tiles)(x, y);
+				if (tile == Tiles::Tile::Stairs_Up   && key.z + 1 < map.chunks.count_z) add_node(graph, { x, y }, { 0, 0,  1 });
+				if (tile == Tiles::Tile::Stairs_Down && key.z > 0)                      add_node(graph, { x, y }, { 0, 0, -1 });
+			}
+		}
+
+		for (i32 node_index = 0; node_index < graph.nodes_count; ++node_index) {
+			auto& node = graph.nodes(node_index);
+			fill_distances(chunk, node.chunk_rel, node.distances);
+		}
+	}
+
+	// один вход на каждый непрерывный проход через границу, посередине прохода.
+	// Соседи сканируют общую границу одинаково, поэтому входы с двух сторон совпадают
+	static void add_border_nodes(Tiles::Map& map, Chunk_Graph& graph, v2<i32> dir) {
+		auto& key = graph.key;
+		Tiles::Chunk_Lookup_Key neighbour_key = { key.x + dir.x, key.y + dir.y, key.z };
+		if (neighbour_key.x < 0 || neighbour_key.x >= map.chunks.count_x ||
+		    neighbour_key.y < 0 || neighbour_key.y >= map.chunks.count_y) return;
+
+		auto& chunk     = map.chunks(key.x, key.y, key.z);
+		auto& neighbour = map.chunks(neighbour_key.x, neighbour_key.y, neighbour_key.z);
+		i32 border = dir.x + dir.y > 0 ? Tiles::CHUNK_DIM_TILES - 1 : 0;
+
+		auto get_border_rel = [&](i32 i) { return dir.x ? v2<i32>{ border, i } : v2<i32>{ i, border }; };
+
+		i32 run_start = -1;
+		for (i32 i = 0; i <= Tiles::CHUNK_DIM_TILES; ++i) {
+			bool is_open = false;
+			if (i < Tiles::CHUNK_DIM_TILES) {
+				v2<i32> rel = get_border_rel(i);
+				v2<i32> neighbour_rel = rel - dir * (Tiles::CHUNK_DIM_TILES - 1);
+				is_open = check_passable(get_chunk_tile(chunk, rel)) && check_passable(get_chunk_tile(neighbour, neighbour_rel));
+			}
+
+			if (is_open && run_start < 0) run_start = i;
+			if (!is_open && run_start >= 0) {
+				add_node(graph, get_border_rel((run_start + i - 1) / 2), { dir.x, dir.y, 0 });
+				run_start = -1;
+			}
+		}
+	}
+
+	static void add_node(Chunk_Graph& graph, v2<i32> chunk_rel, Tiles::Chunk_Lookup_Key link) {
+		assert_or_return_void(graph.nodes_count < CHUNK_MAX_NODES); // LATER: объединять соседние входы
+
+		auto& node = graph.nodes(graph.nodes_count);
+		graph.nodes_count += 1;
+		node = {};
+		node.chunk_rel = chunk_rel;
+		node.link = link;
+	}
+
+	// поиск в ширину по полу чанка. На лестницу можно прийти, но пройти через неё нельзя
+	static void fill_distances(Tiles::Chunk& chunk, v2<i32> source, Array<u8, Tiles::CHUNK_TILES_COUNT>& distances) {
+		for (auto& distance : distances) distance = UNREACHABLE;
+
+		Array<u8, Tiles::CHUNK_TILES_COUNT> queue;
+		i32 queue_read = 0, queue_write = 0;
+		i32 source_index = get_tile_index(source);
+		distances(source_index) = 0;
+		queue(queue_write) = cast<u8>(source_index);
+		queue_write += 1;
+
+		while (queue_read < queue_write) {
+			i32 tile_index = queue(queue_read);
+			queue_read += 1;
+
+			v2<i32> rel = { tile_index % Tiles::CHUNK_DIM_TILES, tile_index / Tiles::CHUNK_DIM_TILES };
+			if (tile_index != source_index && !check_passable(get_chunk_tile(chunk, rel))) continue;
+
+			for (v2<i32> step : NEIGHBOUR_STEPS) {
+				v2<i32> next_rel = rel + step;
+				if (next_rel.x < 0 || next_rel.x >= Tiles::CHUNK_DIM_TILES ||
+				    next_rel.y < 0 || next_rel.y >= Tiles::CHUNK_DIM_TILES) continue;
+
+				i32 next_index = get_tile_index(next_rel);
+				auto next_tile = get_chunk_tile(chunk, next_rel);
+				if (distances(next_index) != UNREACHABLE) continue;
+				if (!check_passable(next_tile) && next_tile != Tiles::Tile::Stairs_Up && next_tile != Tiles::Tile::Stairs_Down) continue;
+
+				assert(distances(tile_index) + 1 < UNREACHABLE);
+				distances(next_index) = cast<u8>(distances(tile_index) + 1);
+				queue(queue_write) = cast<u8>(next_index);
+				queue_write += 1;
+			}
+		}
+	}
+
+	// номер шага в NEIGHBOUR_STEPS к соседу ближе к dest_rel, -1 если ближе некуда.
+	// На лестницу наступаем, только если она и есть цель, иначе она перенесёт на другой этаж
+	static i32 get_descent_step(Tiles::Chunk& chunk, Array<u8, Tiles::CHUNK_TILES_COUNT>& distances, v2<i32> chunk_rel, v2<i32> dest_rel) {
+		u8 best_distance = distances(get_tile_index(chunk_rel));
+		i32 best_step_index = -1;
+		for (i32 step_index = 0; step_index < 4; ++step_index) {
+			v2<i32> next_rel = chunk_rel + NEIGHBOUR_STEPS[step_index];
+			if (next_rel.x < 0 || next_rel.x >= Tiles::CHUNK_DIM_TILES ||
+			    next_rel.y < 0 || next_rel.y >= Tiles::CHUNK_DIM_TILES) continue;
+			if (!(next_rel == dest_rel) && !check_passable(get_chunk_tile(chunk, next_rel))) continue;
+
+			u8 distance = distances(get_tile_index(next_rel));
+			if (distance < best_distance) {
+				best_distance = distance;
+				best_step_index = step_index;
+			}
+		}
+		return best_step_index;
+	}
+
+	static i32 find_node(Chunk_Graph& graph, v2<i32> chunk_rel, Tiles::Chunk_Lookup_Key link) {
+		for (i32 node_index = 0; node_index < graph.nodes_count; ++node_index) {
+			auto& node = graph.nodes(node_index);
+			if (node.chunk_rel == chunk_rel && check_same_chunk(node.link, link)) return node_index;
+		}
+		return -1;
+	}
+
+	static Array<u16, 5> get_tiles_versions(Tiles::Map& map, Tiles::Chunk_Lookup_Key key) {
+		Array<u16, 5> result = {};
+		Array<Tiles::Chunk_Lookup_Key, 5> keys = {{
+			key,
+			{ key.x - 1, key.y, key.z }, { key.x + 1, key.y, key.z },
+			{ key.x, key.y - 1, key.z }, { key.x, key.y + 1, key.z },
+		}};
+		for (i32 i = 0; i < keys.get_count(); ++i) {
+			auto& k = keys(i);
+			if (k.x < 0 || k.x >= map.chunks.count_x || k.y < 0 || k.y >= map.chunks.count_y) continue;
+			result(i) = map.chunks(k.x, k.y, k.z).tiles_version;
+		}
+		return result;
+	}
+
+	// за краем мира чанков нет, их тоже можно читать
+	static bool check_chunk_readable(Tiles::Map& map, Tiles::Chunk_Lookup_Key key) {
+		if (key.x < 0 || key.x >= map.chunks.count_x || key.y < 0 || key.y >= map.chunks.count_y) return true;
+
+		auto state = map.chunks(key.x, key.y, key.z).state;
+		return state == Tiles::Chunk_State::Resident || state == Tiles::Chunk_State::Saving;
+	}
+
+	static bool check_passable(Tiles::Tile tile) {
+		return tile == Tiles::Tile::Floor;
+	}
+
+	static bool check_same_chunk(Tiles::Chunk_Lookup_Key a, Tiles::Chunk_Lookup_Key b) {
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+
+	static Tiles::Tile get_chunk_tile(Tiles::Chunk& chunk, v2<i32> chunk_rel) {
+		if (!chunk.tiles) return Tiles::Tile::Not_Initialized;
+		return (*chunk.tiles)(chunk_rel.x, chunk_rel.y);
+	}
+
+	static i32 get_tile_index(v2<i32> chunk_rel) {
+		return chunk_rel.y * Tiles::CHUNK_DIM_TILES + chunk_rel.x;
+	}
+
+	static Path_Point get_path_point(Tiles::Position& pos) {
+		return { pos.abs_xy, pos.abs_z };
+	}
+}
\ No newline at end of file
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "globals.hpp"
+#include "tiles.hpp"
+
+// иерархический поиск пути: A* по графу входов между чанками, внутри чанка путь берётся из готовых полей расстояний
+namespace Paths {
+	static constexpr i32 CHUNK_MAX_NODES = 48;
+	static constexpr u8 UNREACHABLE = UINT8_MAX;
+	static constexpr i32 MAX_PATHS = 2048;
+	static constexpr i32 MAX_WAYPOINTS = 256;
+	static constexpr i32 MAX_EXPANSIONS_PER_QUERY = 2048;
+	static constexpr u64 PATHFINDER_CYCLES_PER_FRAME = 2'000'000; // после стольких тактов остальные запросы ждут следующего кадра, начатый поиск доводится до конца
+	static constexpr i32 FLOW_RADIUS_CHUNKS = 4;
+	static constexpr u16 FLOW_UNREACHABLE = UINT16_MAX;
+	static constexpr v2<i32> NEIGHBOUR_STEPS[] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+
+	struct Chunk_Graph;
+
+	struct Node_Ref {
+		Chunk_Graph* graph; // nullptr у цели
+		i32 index;
+	};
+
+	// узел стоит на тайле у границы чанка или на лестнице и связан с узлом соседнего чанка
+	struct Node {
+		v2<i32> chunk_rel;
+		Tiles::Chunk_Lookup_Key link;                // смещение к связанному тайлу: x,y через границу или z по лестнице
+		Array<u8, Tiles::CHUNK_TILES_COUNT> distances; // шагов внутри чанка от каждого тайла до узла
+
+		// состояние поиска, действительно пока search_index совпадает с Pathfinder::search_index
+		u32 search_index;
+		bool is_closed;
+		i32 cost;
+		Node_Ref parent;
+	};
+
+	struct Chunk_Graph {
+		Tiles::Chunk_Lookup_Key key;
+		Array<u16, 5> tiles_versions; // чанк и четыре соседа, при расхождении граф перестраивается
+		i32 nodes_count;
+		Array<Node, CHUNK_MAX_NODES> nodes;
+	};
+
+	struct Path_Point {
+		v2<i32> abs_xy;
+		i32 abs_z;
+	};
+
+	enum struct Path_State {
+		Queued,
+		Released, // освобождён, пока стоял в очереди
+		Found,
+		Not_Found,
+	};
+
+	struct Path {
+		Path_State state;
+		Path_Point start, goal;
+		i32 waypoints_count;
+		i32 next_waypoint;
+		Array<Path_Point, MAX_WAYPOINTS> waypoints; // узлы графа по порядку, последняя точка это цель
+		Array<u8, Tiles::CHUNK_TILES_COUNT> goal_distances;
+	};
+
+	struct Pathfinder {
+		slice3<Chunk_Graph*> graphs; // по одному на чанк, создаются при первом поиске через чанк
+		Pool<Path> path_pool;
+		slice<Path*> queue;
+		i64 queue_read, queue_write;
+		u32 search_index;
+		u32 graphs_version; // растёт при каждой перестройке графа
+	};
+
+	struct Flow_Chunk {
+		Chunk_Graph* graph;
+		Array<u16, CHUNK_MAX_NODES> exit_costs; // от узла через его связь до цели
+		bool is_filled;
+		Array<u16, Tiles::CHUNK_TILES_COUNT> integration;
+		Array<u8, Tiles::CHUNK_TILES_COUNT> directions; // 0 = стоять, иначе номер в NEIGHBOUR_STEPS + 1
+	};
+
+	// общее поле направлений к одной цели для толпы. Стоимости считаются по графу чанков,
+	// тайловые поля чанка заполняются при первом обращении к нему после сдвига цели
+	struct Flow_Field {
+		Path_Point target;
+		Tiles::Chunk_Lookup_Key region_min;
+		slice3<Flow_Chunk> chunks; // квадрат FLOW_RADIUS_CHUNKS вокруг чанка цели на всех этажах
+		Array<u8, Tiles::CHUNK_TILES_COUNT> goal_distances;
+		u32 graphs_version;
+		bool is_valid;
+	};
+
+	static void init_pathfinder(Arena& world_arena, Tiles::Map& map, Pathfinder& pathfinder);
+	static Path* request_path(Arena& world_arena, Pathfinder& pathfinder, Tiles::Position& start, Tiles::Position& goal);
+	static void release_path(Pathfinder& pathfinder, Path* path);
+	static void update_pathfinder(Arena& world_arena, Arena& scratch_arena, Tiles::Map& map, Pathfinder& pathfinder);
+	static v2<i32> get_path_step(Pathfinder& pathfinder, Tiles::Map& map, Path& path, Tiles::Position& pos);
+
+	static void init_flow_field(Arena& world_arena, Tiles::Map& map, Flow_Field& field);
+	static void update_flow_field(Arena& world_arena, Arena& scratch_arena, Tiles::Map& map, Pathfinder& pathfinder, Flow_Field& field, Tiles::Position& target);
+	static v2<i32> get_flow_step(Tiles::Map& map, Flow_Field& field, Tiles::Position& pos);
+	static void prepare_flow_chunk(Tiles::Map& map, Flow_Field& field, Tiles::Chunk_Lookup_Key key);
+	static void fill_flow_chunk(Tiles::Map& map, Flow_Field& field, Flow_Chunk& flow_chunk);
+	static bool shift_flow_chunk(Flow_Chunk& flow_chunk, Array<u16, CHUNK_MAX_NODES>& old_exit_costs);
+	static Flow_Chunk* get_flow_chunk(Flow_Field& field, Tiles::Chunk_Lookup_Key key);
+
+	static void find_path(Arena& world_arena, Arena& scratch_arena, Tiles::Map& map, Pathfinder& pathfinder, Path& path);
+	static Chunk_Graph* get_chunk_graph(Arena& world_arena, Tiles::Map& map, Pathfinder& pathfinder, Tiles::Chunk_Lookup_Key key);
+	static void build_chunk_graph(Tiles::Map& map, Chunk_Graph& graph);
+	static void add_border_nodes(Tiles::Map& map, Chunk_Graph& graph, v2<i32> dir);
+	static void add_node(Chunk_Graph& graph, v2<i32> chunk_rel, Tiles::Chunk_Lookup_Key link);
+	static void fill_distances(Tiles::Chunk& chunk, v2<i32> source, Array<u8, Tiles::CHUNK_TILES_COUNT>& distances);
+	static i32 get_descent_step(Tiles::Chunk& chunk, Array<u8, Tiles::CHUNK_TILES_COUNT>& distances, v2<i32> chunk_rel, v2<i32> dest_rel);
+	static i32 find_node(Chunk_Graph& graph, v2<i32> chunk_rel, Tiles::Chunk_Lookup_Key link);
+	static Array<u16, 5> get_tiles_versions(Tiles::Map& map, Tiles::Chunk_Lookup_Key key);
+	static bool check_chunk_readable(Tiles::Map& map, Tiles::Chunk_Lookup_Key key);
+	static bool check_passable(Tiles::Tile tile);
+	static bool check_same_chunk(Tiles::Chunk_Lookup_Key a, Tiles::Chunk_Lookup_Key b);
+	static Tiles::Tile get_chunk_tile(Tiles::Chunk& chunk, v2<i32> chunk_rel);
+	static i32 get_tile_index(v2<i32> chunk_rel);
+	static Path_Point get_path_point(Tiles::Position& pos);
+}
\ No newline at end of file
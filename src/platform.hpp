@@ -0,0 +1,59 @@
+#pragma once
+
+#include "globals.hpp"
+
+// сервисы, которые платформенный слой предоставляет игре
+namespace Game {
+	struct Thread {};
+
+	// -1 если файла нет
+	static i64 get_file_size(Thread& thread, cstr file_name);
+	using Get_File_Size = decltype(get_file_size);
+
+	// читает ровно file.get_size() байт с начала файла в память вызывающего, сама ничего не выделяет
+	static bool read_file(Thread& thread, cstr file_name, slice<u8> file);
+	using Read_File = decltype(read_file);
+
+	static void write_file(Thread& thread, cstr file_name, slice<u8> file);
+	using Write_File = decltype(write_file);
+
+	// страницы копируются при записи, файл на диске не меняется. Пустой slice если файла нет
+	static slice<u8> map_file(Thread& thread, cstr file_name);
+	using Map_File = decltype(map_file);
+
+	static void unmap_file(Thread& thread, slice<u8>& file);
+	using Unmap_File = decltype(unmap_file);
+
+	struct File {
+		void* handle;
+	};
+
+	// открывает на чтение и запись, создаёт если файла нет
+	static File open_file(Thread& thread, cstr file_name);
+	using Open_File = decltype(open_file);
+
+	// только на чтение, handle nullptr если файла нет
+	static File open_file_for_reading(Thread& thread, cstr file_name);
+	using Open_File_For_Reading = decltype(open_file_for_reading);
+
+	static void close_file(Thread& thread, File& file);
+	using Close_File = decltype(close_file);
+
+	// безопасно вызывать с разных потоков для одного File
+	static bool read_file_block(Thread& thread, File file, i64 offset, slice<u8> block);
+	using Read_File_Block = decltype(read_file_block);
+
+	static bool write_file_block(Thread& thread, File file, i64 offset, slice<u8> block);
+	using Write_File_Block = decltype(write_file_block);
+
+	struct Work_Queue;
+	using Work_Callback = void(Thread& thread, void* data);
+
+	// добавлять работу можно только с главного потока
+	static void add_work(Thread& thread, Work_Queue& queue, Work_Callback* callback, void* data);
+	using Add_Work = decltype(add_work);
+
+	// главный поток помогает выполнять работу, пока очередь не опустеет
+	static void complete_all_work(Thread& thread, Work_Queue& queue);
+	using Complete_All_Work = decltype(complete_all_work);
+}
\ No newline at end of file
@@ -0,0 +1,186 @@
+#include "rays.hpp"
+
+namespace Rays {
+	static void init_raycaster(Arena& world_arena, Tiles::Map& map, Raycaster& raycaster) {
+		auto& masks = raycaster.masks;
+		masks.count_x = map.chunks.count_x;
+		masks.count_y = map.chunks.count_y;
+		masks.count_z = map.chunks.count_z;
+		masks.ptr = world_arena.push<Wall_Mask>(masks.get_size(), alignof(Wall_Mask), "rays");
+	}
+
+	static Ray_Hit raycast(Tiles::Map& map, Raycaster& raycaster, Ray& ray) {
+		return trace_ray(map, raycaster, ray, false);
+	}
+
+	static bool check_line_of_sight(Tiles::Map& map, Raycaster& raycaster, Tiles::Position& from, Tiles::Position& to) {
+		if (from.abs_z != to.abs_z) return false;
+
+		v2<f32> diff = Tiles::subtract_positions(to, from);
+		f32 distance = std::sqrt(dot(diff, diff));
+		if (distance == 0) return true;
+
+		Ray ray = { from, diff / distance, distance };
+		return !raycast(map, raycaster, ray).is_hit;
+	}
+
+	// маски всех задетых чанков обновляются заранее, дальше лучи только читают их и считаются параллельно
+	static void raycast_batch(Game::Thread& thread, Arena& scratch_arena, Tiles::Map& map, Raycaster& raycaster, slice<Ray> rays, slice<Ray_Hit> hits) {
+		assert_or_return_void(hits.count >= rays.count);
+
+		for (auto& ray : rays) {
+			v2<f32> from = cast<v2<f32>>(ray.origin.abs_xy) + ray.origin.tile_rel / Tiles::TILE_DIM;
+			v2<f32> to = from + ray.dir * (ray.max_distance / Tiles::TILE_DIM);
+			v2<i32> tile_min = { hm::floor(hm::min(from.x, to.x)), hm::floor(hm::min(from.y, to.y)) };
+			v2<i32> tile_max = { hm::floor(hm::max(from.x, to.x)), hm::floor(hm::max(from.y, to.y)) };
+			auto key_min = Tiles::get_chunk_lookup_key(hm::max(tile_min.x, 0), hm::max(tile_min.y, 0), ray.origin.abs_z);
+			auto key_max = Tiles::get_chunk_lookup_key(hm::max(tile_max.x, 0), hm::max(tile_max.y, 0), ray.origin.abs_z);
+			key_max.x = hm::min(key_max.x, map.chunks.count_x - 1);
+			key_max.y = hm::min(key_max.y, map.chunks.count_y - 1);
+
+			for (    i32 key_y = key_min.y; key_y <= key_max.y; ++key_y) {
+				for (i32 key_x = key_min.x; key_x <= key_max.x; ++key_x) {
+					get_wall_mask(map, raycaster, { key_x, key_y, ray.origin.abs_z }, false);
+				}
+			}
+		}
+
+		slice<Ray_Job> jobs = {};
+		jobs.count = (rays.count + RAYS_PER_JOB - 1) / RAYS_PER_JOB;
+		jobs.ptr = scratch_arena.push<Ray_Job>(jobs.get_size());
+
+		for (i64 job_index = 0; job_index < jobs.count; ++job_index) {
+			auto& job = jobs(job_index);
+			i64 first_ray = job_index * RAYS_PER_JOB;
+			job.map = &map;
+			job.raycaster = &raycaster;
+			job.rays = { rays.ptr + first_ray, hm::min(RAYS_PER_JOB, rays.count - first_ray) };
+			job.hits = { hits.ptr + first_ray, job.rays.count };
+
+			if (raycaster.queue) raycaster.add_work(thread, *raycaster.queue, do_ray_job, &job);
+			else                 do_ray_job(thread, &job);
+		}
+		if (raycaster.queue) raycaster.complete_all_work(thread, *raycaster.queue);
+	}
+
+	static void do_ray_job(Game::Thread& thread, void* data) {
+		auto& job = *cast<Ray_Job*>(data);
+		for (i64 ray_index = 0; ray_index < job.rays.count; ++ray_index) {
+			job.hits(ray_index) = trace_ray(*job.map, *job.raycaster, job.rays(ray_index), true);
+		}
+	}
+
+	// координаты в тайлах, расстояние в результате в единицах мира
+	static Ray_Hit trace_ray(Tiles::Map& map, Raycaster& raycaster, Ray& ray, bool is_masks_updated) {
+		Ray_Hit hit = {};
+		hit.distance = NO_HIT_DISTANCE;
+
+		v2<f32> origin = cast<v2<f32>>(ray.origin.abs_xy) + ray.origin.tile_rel / Tiles::TILE_DIM;
+		v2<f32> dir = ray.dir;
+		f32 max_t = ray.max_distance / Tiles::TILE_DIM;
+		i32 z = ray.origin.abs_z;
+
+		v2<i32> cell = ray.origin.abs_xy;
+		v2<i32> step = { hm::sign<i32>(dir.x), hm::sign<i32>(dir.y) };
+		v2<f32> t_max   = { NO_HIT_DISTANCE, NO_HIT_DISTANCE };
+		v2<f32> t_delta = { NO_HIT_DISTANCE, NO_HIT_DISTANCE };
+		for (i32 axis = 0; axis < 2; ++axis) {
+			if (!step(axis)) continue;
+			f32 boundary = cast<f32>(cell(axis) + (step(axis) > 0));
+			t_max(axis)   = (boundary - origin(axis)) / dir(axis);
+			t_delta(axis) = step(axis) / dir(axis);
+		}
+
+		f32 t = 0;
+		i32 last_axis = -1;
+		while (t <= max_t) {
+			auto key = Tiles::get_chunk_lookup_key(cell.x, cell.y, z);
+			auto* mask = get_wall_mask(map, raycaster, key, is_masks_updated);
+
+			if (!mask) break; // за край мира луч уходит насовсем
+			if (!mask->is_built || mask->tiles_version != map.chunks(key.x, key.y, key.z).tiles_version) {
+				// что в чанке, сейчас не узнать, поэтому сквозь него не видно
+				hit.is_hit = true;
+				hit.is_unknown = true;
+				hit.tile_xy = cell;
+				if (last_axis >= 0) hit.normal(last_axis) = -step(last_axis);
+				hit.distance = t * Tiles::TILE_DIM;
+				return hit;
+			}
+			if (!mask->has_walls) {
+				// выходим из чанка по ближайшей границе, вторая координата пересчитывается от начала луча
+				v2<i32> chunk_min = { key.x << Tiles::CHUNK_LOOKUP_KEY_SHIFT, key.y << Tiles::CHUNK_LOOKUP_KEY_SHIFT };
+				v2<f32> t_exit = { NO_HIT_DISTANCE, NO_HIT_DISTANCE };
+				for (i32 axis = 0; axis < 2; ++axis) {
+					if (!step(axis)) continue;
+					f32 boundary = cast<f32>(chunk_min(axis) + (step(axis) > 0 ? Tiles::CHUNK_DIM_TILES : 0));
+					t_exit(axis) = (boundary - origin(axis)) / dir(axis);
+				}
+
+				i32 axis = t_exit.x < t_exit.y ? 0 : 1;
+				i32 other = 1 - axis;
+				t = t_exit(axis);
+				if (t > max_t) break;
+
+				cell(axis) = chunk_min(axis) + (step(axis) > 0 ? Tiles::CHUNK_DIM_TILES : -1);
+				t_max(axis) = t + t_delta(axis);
+				if (step(other)) {
+					i32 other_cell = hm::floor(origin(other) + dir(other) * t);
+					cell(other) = hm::min(hm::max(other_cell, chunk_min(other)), chunk_min(other) + Tiles::CHUNK_DIM_TILES - 1);
+					f32 boundary = cast<f32>(cell(other) + (step(other) > 0));
+					t_max(other) = (boundary - origin(other)) / dir(other);
+				}
+				last_axis = axis;
+				continue;
+			}
+
+			v2<i32> rel = Tiles::get_chunk_rel_position(cell.x, cell.y);
+			if (mask->rows(rel.y) & (1 << rel.x)) {
+				hit.is_hit = true;
+				hit.tile_xy = cell;
+				if (last_axis >= 0) hit.normal(last_axis) = -step(last_axis);
+				hit.distance = t * Tiles::TILE_DIM;
+				return hit;
+			}
+
+			last_axis = t_max.x < t_max.y ? 0 : 1;
+			t = t_max(last_axis);
+			cell(last_axis) += step(last_axis);
+			t_max(last_axis) += t_delta(last_axis);
+		}
+		return hit;
+	}
+
+	// nullptr за краем мира. Маска чанка, который сейчас нельзя прочитать, остаётся старой,
+	// trace_ray по версии тайлов решает, можно ли ей верить
+	static Wall_Mask* get_wall_mask(Tiles::Map& map, Raycaster& raycaster, Tiles::Chunk_Lookup_Key key, bool is_masks_updated) {
+		if (key.x < 0 || key.x >= map.chunks.count_x ||
+		    key.y < 0 || key.y >= map.chunks.count_y ||
+		    key.z < 0 || key.z >= map.chunks.count_z) return nullptr;
+
+		auto& mask = raycaster.masks(key.x, key.y, key.z);
+		if (is_masks_updated) return &mask;
+
+		auto& chunk = map.chunks(key.x, key.y, key.z);
+		if (mask.is_built && mask.tiles_version == chunk.tiles_version) return &mask;
+		if (chunk.state != Tiles::Chunk_State::Resident && chunk.state != Tiles::Chunk_State::Saving) return &mask;
+
+		update_wall_mask(map, mask, chunk);
+		return &mask;
+	}
+
+	static void update_wall_mask(Tiles::Map& map, Wall_Mask& mask, Tiles::Chunk& chunk) {
+		mask.is_built = true;
+		mask.tiles_version = chunk.tiles_version;
+		mask.has_walls = false;
+
+		for (i32 y = 0; y < Tiles::CHUNK_DIM_TILES; ++y) {
+			u16 row = 0;
+			for (i32 x = 0; chunk.tiles && x < Tiles::CHUNK_DIM_TILES; ++x) {
+				if ((*chunk.tiles)(x, y) == Tiles::Tile::Wall) row |= cast<u16>(1 << x);
+			}
+			mask.rows(y) = row;
+			if (row) mask.has_walls = true;
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "globals.hpp"
+#include "platform.hpp"
+#include "tiles.hpp"
+
+// лучи по сетке тайлов (Amanatides-Woo): чанк без стен пролетаем целиком, в остальных шагаем по маске стен
+namespace Rays {
+	static constexpr i64 RAYS_PER_JOB = 256;
+	static constexpr f32 NO_HIT_DISTANCE = 1e30f;
+
+	// бит x в строке y это стена
+	struct Wall_Mask {
+		Array<u16, Tiles::CHUNK_DIM_TILES> rows;
+		u16 tiles_version;
+		bool is_built;
+		bool has_walls;
+	};
+
+	struct Raycaster {
+		slice3<Wall_Mask> masks;
+		Game::Work_Queue* queue; // nullptr = пачки лучей считаются на главном потоке
+		Game::Add_Work* add_work;
+		Game::Complete_All_Work* complete_all_work;
+	};
+
+	struct Ray {
+		Tiles::Position origin;
+		v2<f32> dir; // единичный
+		f32 max_distance;
+	};
+
+	struct Ray_Hit {
+		bool is_hit;
+		bool is_unknown; // упёрлись в чанк, которого нет в памяти и для которого нет маски. Считается попаданием
+		v2<i32> tile_xy;
+		v2<i32> normal;
+		f32 distance;
+	};
+
+	struct Ray_Job {
+		Tiles::Map* map;
+		Raycaster* raycaster;
+		slice<Ray> rays;
+		slice<Ray_Hit> hits;
+	};
+
+	static void init_raycaster(Arena& world_arena, Tiles::Map& map, Raycaster& raycaster);
+	static Ray_Hit raycast(Tiles::Map& map, Raycaster& raycaster, Ray& ray);
+	static bool check_line_of_sight(Tiles::Map& map, Raycaster& raycaster, Tiles::Position& from, Tiles::Position& to);
+	static void raycast_batch(Game::Thread& thread, Arena& scratch_arena, Tiles::Map& map, Raycaster& raycaster, slice<Ray> rays, slice<Ray_Hit> hits);
+	static void do_ray_job(Game::Thread& thread, void* data);
+
+	static Ray_Hit trace_ray(Tiles::Map& map, Raycaster& raycaster, Ray& ray, bool is_masks_updated);
+	static Wall_Mask* get_wall_mask(Tiles::Map& map, Raycaster& raycaster, Tiles::Chunk_Lookup_Key key, bool is_masks_updated);
+	static void update_wall_mask(Tiles::Map& map, Wall_Mask& mask, Tiles::Chunk& chunk);
+}
\ No newline at end of file
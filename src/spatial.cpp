@@ -0,0 +1,152 @@
+#include "spatial.hpp"
+
+namespace Spatial {
+	static Grid build_grid(Arena& scratch_arena, Tiles::Position& origin, slice<Tiles::Position> positions, slice<v2<f32>> dims) {
+		assert(dims.count == positions.count);
+
+		Grid grid = {};
+		grid.origin = origin;
+		grid.count = cast<i32>(positions.count);
+
+		u32 buckets_count = 64;
+		while (buckets_count < 2 * cast<u32>(grid.count)) buckets_count *= 2;
+		grid.buckets_mask = buckets_count - 1;
+
+		grid.bucket_starts.count = buckets_count + 1;
+		grid.items.count     = grid.count;
+		grid.cells.count     = grid.count;
+		grid.centers.count   = grid.count;
+		grid.half_dims.count = grid.count;
+		grid.zs.count        = grid.count;
+		grid.bucket_starts.ptr = scratch_arena.push<i32>(grid.bucket_starts.get_size());
+		grid.items.ptr     = scratch_arena.push<i32>(grid.items.get_size());
+		grid.cells.ptr     = scratch_arena.push<Cell_Key>(grid.cells.get_size());
+		grid.centers.ptr   = scratch_arena.push<v2<f32>>(grid.centers.get_size());
+		grid.half_dims.ptr = scratch_arena.push<v2<f32>>(grid.half_dims.get_size());
+		grid.zs.ptr        = scratch_arena.push<i32>(grid.zs.get_size());
+
+		for (auto& start : grid.bucket_starts) start = 0;
+		for (i32 index = 0; index < grid.count; ++index) {
+			grid.centers(index)   = Tiles::subtract_positions(positions(index), origin);
+			grid.half_dims(index) = dims(index) / 2;
+			grid.zs(index)        = positions(index).abs_z;
+			grid.cells(index)     = get_cell_key(grid, grid.centers(index), grid.zs(index));
+			grid.max_half_dim = hm::max(grid.max_half_dim, grid.half_dims(index));
+			grid.bucket_starts(get_bucket(grid, grid.cells(index)) + 1) += 1;
+		}
+		for (u32 bucket = 0; bucket < buckets_count; ++bucket) {
+			grid.bucket_starts(bucket + 1) += grid.bucket_starts(bucket);
+		}
+
+		// раскладываем по корзинам, сдвигая начала, потом возвращаем их на место
+		for (i32 index = 0; index < grid.count; ++index) {
+			u32 bucket = get_bucket(grid, grid.cells(index));
+			grid.items(grid.bucket_starts(bucket)) = index;
+			grid.bucket_starts(bucket) += 1;
+		}
+		for (u32 bucket = buckets_count; bucket > 0; --bucket) {
+			grid.bucket_starts(bucket) = grid.bucket_starts(bucket - 1);
+		}
+		grid.bucket_starts(0) = 0;
+		return grid;
+	}
+
+	// возвращает число найденных, в result попадают первые result.count
+	static i64 query_aabb(Grid& grid, Tiles::Position& center, v2<f32> half_dim, slice<i32> result) {
+		v2<f32> rel = Tiles::subtract_positions(center, grid.origin);
+		return query_rel_aabb(grid, rel - half_dim, rel + half_dim, center.abs_z, 0, result);
+	}
+
+	static i64 query_radius(Grid& grid, Tiles::Position& center, f32 radius, slice<i32> result) {
+		v2<f32> rel = Tiles::subtract_positions(center, grid.origin);
+		v2<f32> half_dim = { radius, radius };
+		return query_rel_aabb(grid, rel - half_dim, rel + half_dim, center.abs_z, radius, result);
+	}
+
+	// каждую пару отдаёт один раз, пары лежат в scratch_arena подряд
+	static slice<Pair> find_overlapping_pairs(Arena& scratch_arena, Grid& grid) {
+		slice<Pair> pairs = {};
+		pairs.ptr = scratch_arena.push<Pair>(0); // только выравниваем, пары дописываются следом
+
+		for (i32 index = 0; index < grid.count; ++index) {
+			v2<f32> min = grid.centers(index) - grid.half_dims(index) - grid.max_half_dim;
+			v2<f32> max = grid.centers(index) + grid.half_dims(index) + grid.max_half_dim;
+			auto key_min = get_cell_key(grid, min, grid.zs(index));
+			auto key_max = get_cell_key(grid, max, grid.zs(index));
+
+			for (    i32 cell_y = key_min.y; cell_y <= key_max.y; ++cell_y) {
+				for (i32 cell_x = key_min.x; cell_x <= key_max.x; ++cell_x) {
+					Cell_Key key = { cell_x, cell_y, grid.zs(index) };
+					u32 bucket = get_bucket(grid, key);
+
+					for (i32 item = grid.bucket_starts(bucket); item < grid.bucket_starts(bucket + 1); ++item) {
+						i32 other = grid.items(item);
+						if (other <= index) continue;
+
+						auto& other_key = grid.cells(other);
+						if (other_key.x != key.x || other_key.y != key.y || other_key.z != key.z) continue;
+						if (!check_aabb_overlap(grid, other, grid.centers(index) - grid.half_dims(index), grid.centers(index) + grid.half_dims(index))) continue;
+
+						*scratch_arena.push<Pair>(size_of(Pair)) = { index, other };
+						pairs.count += 1;
+					}
+				}
+			}
+		}
+		return pairs;
+	}
+
+	// radius = 0 это просто пересечение прямоугольников, иначе круг с центром в середине min..max
+	static i64 query_rel_aabb(Grid& grid, v2<f32> min, v2<f32> max, i32 z, f32 radius, slice<i32> result) {
+		auto key_min = get_cell_key(grid, min - grid.max_half_dim, z);
+		auto key_max = get_cell_key(grid, max + grid.max_half_dim, z);
+		v2<f32> center = (min + max) / 2;
+		i64 found = 0;
+
+		for (    i32 cell_y = key_min.y; cell_y <= key_max.y; ++cell_y) {
+			for (i32 cell_x = key_min.x; cell_x <= key_max.x; ++cell_x) {
+				Cell_Key key = { cell_x, cell_y, z };
+				u32 bucket = get_bucket(grid, key);
+
+				for (i32 item = grid.bucket_starts(bucket); item < grid.bucket_starts(bucket + 1); ++item) {
+					i32 index = grid.items(item);
+
+					// в корзине бывают чужие ячейки, их проверит свой проход
+					auto& index_key = grid.cells(index);
+					if (index_key.x != key.x || index_key.y != key.y || index_key.z != key.z) continue;
+					if (!check_aabb_overlap(grid, index, min, max)) continue;
+
+					if (radius) {
+						v2<f32> closest = hm::min(hm::max(center, grid.centers(index) - grid.half_dims(index)), grid.centers(index) + grid.half_dims(index));
+						v2<f32> diff = closest - center;
+						if (dot(diff, diff) > radius * radius) continue;
+					}
+
+					if (found < result.count) result(found) = index;
+					found += 1;
+				}
+			}
+		}
+		return found;
+	}
+
+	static bool check_aabb_overlap(Grid& grid, i32 index, v2<f32> min, v2<f32> max) {
+		v2<f32> index_min = grid.centers(index) - grid.half_dims(index);
+		v2<f32> index_max = grid.centers(index) + grid.half_dims(index);
+		return index_min.x < max.x && min.x < index_max.x &&
+		       index_min.y < max.y && min.y < index_max.y;
+	}
+
+	// ячейка считается от абсолютного тайла, так что границы ячеек совпадают с границами тайлов и чанков
+	static Cell_Key get_cell_key(Grid& grid, v2<f32> rel, i32 z) {
+		v2<f32> origin_rel = rel + grid.origin.tile_rel;
+		i32 tile_x = grid.origin.abs_xy.x + hm::floor(origin_rel.x / Tiles::TILE_DIM);
+		i32 tile_y = grid.origin.abs_xy.y + hm::floor(origin_rel.y / Tiles::TILE_DIM);
+		return { tile_x >> CELL_SHIFT, tile_y >> CELL_SHIFT, z };
+	}
+
+	static u32 get_bucket(Grid& grid, Cell_Key key) {
+		u32 hash = cast<u32>(key.x) * 73856093u ^ cast<u32>(key.y) * 19349663u ^ cast<u32>(key.z) * 83492791u;
+		return hash & grid.buckets_mask;
+	}
+}
\ No newline at end of file
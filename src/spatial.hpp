@@ -0,0 +1,42 @@
+#pragma once
+
+#include "globals.hpp"
+#include "tiles.hpp"
+
+// равномерная сетка для запросов между сущностями. Ячейки выровнены по тайлам и чанкам,
+// ячейки хешируются в корзины, сетка заново строится сортировкой подсчётом каждый кадр
+namespace Spatial {
+	static constexpr i32 CELL_SHIFT = 1; // ячейка 2x2 тайла, в чанке целое число ячеек
+
+	struct Cell_Key {
+		i32 x, y, z;
+	};
+
+	struct Pair {
+		i32 a, b; // a < b
+	};
+
+	// координаты сущностей относительно origin, индексы совпадают с входными массивами
+	struct Grid {
+		Tiles::Position origin;
+		i32 count;
+		u32 buckets_mask;
+		slice<i32> bucket_starts; // buckets + 1, элементы корзины лежат в items между соседними началами
+		slice<i32> items;
+		slice<Cell_Key> cells;
+		slice<v2<f32>> centers;
+		slice<v2<f32>> half_dims;
+		slice<i32> zs;
+		v2<f32> max_half_dim; // сущность кладём в ячейку центра, запросы расширяем на самую большую
+	};
+
+	static Grid build_grid(Arena& scratch_arena, Tiles::Position& origin, slice<Tiles::Position> positions, slice<v2<f32>> dims);
+	static i64 query_aabb(Grid& grid, Tiles::Position& center, v2<f32> half_dim, slice<i32> result);
+	static i64 query_radius(Grid& grid, Tiles::Position& center, f32 radius, slice<i32> result);
+	static slice<Pair> find_overlapping_pairs(Arena& scratch_arena, Grid& grid);
+
+	static i64 query_rel_aabb(Grid& grid, v2<f32> min, v2<f32> max, i32 z, f32 radius, slice<i32> result);
+	static bool check_aabb_overlap(Grid& grid, i32 index, v2<f32> min, v2<f32> max);
+	static Cell_Key get_cell_key(Grid& grid, v2<f32> rel, i32 z);
+	static u32 get_bucket(Grid& grid, Cell_Key key);
+}
\ No newline at end of file
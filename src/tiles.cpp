@@ -7,7 +7,11 @@ namespace Tiles {
 	}
 
 	static bool check_walkable_tile(Map& map, Position& pos) {
-		switch (get_tile(map, pos.abs_xy.x, pos.abs_xy.y, pos.abs_z)) {
+		return check_walkable(get_tile(map, pos.abs_xy.x, pos.abs_xy.y, pos.abs_z));
+	}
+
+	static bool check_walkable(Tile tile) {
+		switch (tile) {
 			case Tile::Floor:
 			case Tile::Stairs_Up:
 			case Tile::Stairs_Down: return true;
@@ -17,10 +21,12 @@ namespace Tiles {
 
 	static Tile get_tile(Map& map, i32 abs_x, i32 abs_y, i32 abs_z) {
 		auto* chunk_ptr = get_chunk(map, abs_x, abs_y, abs_z);
-		if (!chunk_ptr || !chunk_ptr->tiles.ptr) return {};
+		if (!chunk_ptr) return {};
+		if (chunk_ptr->state == Chunk_State::Generating) return Tile::Not_Generated;
+		if (!chunk_ptr->tiles) return {};
 		
 		v2<i32> chunk_rel_pos = get_chunk_rel_position(abs_x, abs_y);
-		return chunk_ptr->tiles(chunk_rel_pos.x, chunk_rel_pos.y);
+		return (*chunk_ptr->tiles)(chunk_rel_pos.x, chunk_rel_pos.y);
 	};
 
 	static void set_tile(Arena& world_arena, Map& map, i32 abs_x, i32 abs_y, i32 abs_z, Tile value) {
@@ -31,14 +37,287 @@ namespace Tiles {
 		}
 
 		auto& chunk = *chunk_ptr;
-		if (!chunk.tiles.ptr) {
-			chunk.tiles.ptr = world_arena.push<Tiles::Tile>(chunk.tiles.get_size());
-			for (auto& tile : chunk.tiles) {
+		// LATER: запись в выгруженный чанк, пока пишем только рядом с камерой
+		assert_or_return_void(chunk.state == Chunk_State::Resident);
+
+		if (!chunk.tiles) {
+			for (auto& tile : add_chunk_tiles(world_arena, map, chunk)->tiles) {
 				tile = Tiles::Tile::Floor;
 			}
 		}
+
 		v2<i32> chunk_rel_pos = get_chunk_rel_position(abs_x, abs_y);
-		chunk.tiles(chunk_rel_pos.x, chunk_rel_pos.y) = value;
+		if ((*chunk.tiles)(chunk_rel_pos.x, chunk_rel_pos.y) == value) return; // не копируем разделяемые тайлы ради той же записи
+
+		unshare_chunk_tiles(world_arena, map, chunk);
+		(*chunk.tiles)(chunk_rel_pos.x, chunk_rel_pos.y) = value;
+		chunk.is_dirty = true;
+		chunk.tiles_version += 1;
+	}
+
+	static void share_chunks(Map& map, v2<i32> abs_min, v2<i32> abs_max, i32 abs_z) {
+		auto key_min = get_chunk_lookup_key(abs_min.x, abs_min.y, abs_z);
+		auto key_max = get_chunk_lookup_key(abs_max.x, abs_max.y, abs_z);
+
+		for (    i32 key_y = key_min.y; key_y <= key_max.y; ++key_y) {
+			for (i32 key_x = key_min.x; key_x <= key_max.x; ++key_x) {
+				auto* chunk_ptr = get_chunk(map, key_x << CHUNK_LOOKUP_KEY_SHIFT, key_y << CHUNK_LOOKUP_KEY_SHIFT, abs_z);
+				if (chunk_ptr) share_chunk_tiles(map, *chunk_ptr);
+			}
+		}
+	}
+
+	static void share_chunk_tiles(Map& map, Chunk& chunk) {
+		// тайлы выгружаемого чанка читает фоновый поток, их нельзя освобождать
+		if (!chunk.tiles || chunk.tiles->ref_count || chunk.state != Chunk_State::Resident) return;
+
+		auto& tiles = *chunk.tiles;
+		tiles.hash = get_tiles_hash(tiles);
+		auto& bucket = get_shared_hash_bucket(map, tiles.hash);
+
+		for (auto* shared = bucket; shared; shared = shared->next) {
+			if (shared->hash == tiles.hash && check_same_tiles(*shared, tiles)) {
+				free_chunk_tiles(map, chunk.tiles);
+				shared->ref_count += 1;
+				chunk.tiles = shared;
+				return;
+			}
+		}
+
+		tiles.ref_count = 1;
+		tiles.next = bucket;
+		bucket = &tiles;
+	}
+
+	// copy-on-write: после вызова тайлы принадлежат только этому чанку
+	static void unshare_chunk_tiles(Arena& world_arena, Map& map, Chunk& chunk) {
+		auto* shared = chunk.tiles;
+		if (!shared || !shared->ref_count) return;
+
+		if (shared->ref_count > 1) {
+			shared->ref_count -= 1;
+			chunk.tiles = alloc_chunk_tiles(world_arena, map);
+			chunk.tiles->tiles = shared->tiles;
+			return;
+		}
+
+		// последний владелец забирает тайлы себе без копирования
+		unlink_shared_tiles(map, *shared);
+	}
+
+	static void release_chunk_tiles(Map& map, Chunk_Tiles* tiles) {
+		if (tiles->ref_count > 1) {
+			tiles->ref_count -= 1;
+			return;
+		}
+		if (tiles->ref_count == 1) unlink_shared_tiles(map, *tiles);
+		free_chunk_tiles(map, tiles);
+	}
+
+	static void unlink_shared_tiles(Map& map, Chunk_Tiles& tiles) {
+		// тайлы из файла мира разделяются, но в таблице не лежат
+		auto* bucket = &get_shared_hash_bucket(map, tiles.hash);
+		while (*bucket && *bucket != &tiles) {
+			bucket = &(*bucket)->next;
+		}
+		if (*bucket) *bucket = tiles.next;
+		tiles.next = nullptr;
+		tiles.ref_count = 0;
+	}
+
+	// выгруженные чанки дочитываются из файла пейджера прямо в образы. Пустой slice, если это чтение не удалось
+	static slice<u8> save_world(Game::Thread& thread, Arena& scratch_arena, Map& map, Pager& pager, u32 generator_version) {
+		i64 chunks_count = cast<i64>(map.chunks.count_x) * map.chunks.count_y * map.chunks.count_z;
+		i64 payload_size = get_world_file_payload_size();
+		i64 index_offset = size_of(World_File_Header);
+		i64 payloads_offset = (index_offset + chunks_count * size_of(u32) + WORLD_FILE_PAGE_SIZE - 1) / WORLD_FILE_PAGE_SIZE * WORLD_FILE_PAGE_SIZE;
+
+		// у загружаемого чанка тайлы ещё в задаче, но копия на диске уже верная
+		i64 max_payloads_count = 0;
+		for (auto& chunk : map.chunks) {
+			if (chunk.tiles || chunk.state == Chunk_State::On_Disk || chunk.state == Chunk_State::Loading) max_payloads_count += 1;
+		}
+
+		// разделяемые тайлы пишутся один раз, ищем уже записанные по указателю
+		struct Saved_Tiles {
+			Chunk_Tiles* tiles;
+			u32 payload_index;
+		};
+		slice<Saved_Tiles> saved_table = {};
+		saved_table.count = 2 * max_payloads_count + 1;
+		saved_table.ptr = scratch_arena.push<Saved_Tiles>(saved_table.get_size());
+		hm::memzero(saved_table);
+
+		slice<u8> file = {};
+		file.count = payloads_offset + max_payloads_count * payload_size;
+		file.ptr = scratch_arena.push<u8>(file.count);
+		hm::memzero(file);
+
+		auto& header = cast<World_File_Header&>(*file.ptr);
+		header.magic = WORLD_FILE_MAGIC;
+		header.version = WORLD_FILE_VERSION;
+		header.generator_version = generator_version;
+		header.chunks_count_x = map.chunks.count_x;
+		header.chunks_count_y = map.chunks.count_y;
+		header.chunks_count_z = map.chunks.count_z;
+		header.index_offset = index_offset;
+		header.payloads_offset = payloads_offset;
+		header.payload_size = payload_size;
+
+		slice<u32> index = { cast<u32*>(file.ptr + index_offset), chunks_count };
+		auto get_image = [&](i64 payload_index) -> Chunk_Tiles& {
+			return cast<Chunk_Tiles&>(*(file.ptr + payloads_offset + payload_index * payload_size));
+		};
+
+		for (i64 chunk_index = 0; chunk_index < chunks_count; ++chunk_index) {
+			auto& chunk = map.chunks.ptr[chunk_index];
+			index(chunk_index) = WORLD_FILE_NO_PAYLOAD;
+
+			if (!chunk.tiles) {
+				if (chunk.state != Chunk_State::On_Disk && chunk.state != Chunk_State::Loading) continue;
+
+				u32 payload_index = cast<u32>(header.payloads_count);
+				header.payloads_count += 1;
+
+				auto& image = get_image(payload_index);
+				slice<u8> block = { image.tiles.ptr, image.tiles.get_count() };
+				i64 file_offset = chunk_index * size_of(image.tiles);
+				if (!pager.read_file_block(thread, pager.file, file_offset, block)) return {};
+				image.hash = get_tiles_hash(image);
+				index(chunk_index) = payload_index;
+				continue;
+			}
+
+			Saved_Tiles* saved = nullptr;
+			if (chunk.tiles->ref_count) {
+				i64 slot = cast<i64>((cast<u64>(chunk.tiles) >> 4) % cast<u64>(saved_table.count));
+				while (saved_table(slot).tiles && saved_table(slot).tiles != chunk.tiles) {
+					slot = (slot + 1) % saved_table.count;
+				}
+				saved = &saved_table(slot);
+				if (saved->tiles) {
+					index(chunk_index) = saved->payload_index;
+					continue;
+				}
+			}
+
+			u32 payload_index = cast<u32>(header.payloads_count);
+			header.payloads_count += 1;
+
+			auto& image = get_image(payload_index);
+			image.tiles = chunk.tiles->tiles;
+			image.hash = chunk.tiles->hash;
+			index(chunk_index) = payload_index;
+
+			if (saved) {
+				saved->tiles = chunk.tiles;
+				saved->payload_index = payload_index;
+			}
+		}
+
+		// образ с одной ссылкой после загрузки принадлежит чанку, с несколькими - разделяется
+		for (u32 payload_index : index) {
+			if (payload_index != WORLD_FILE_NO_PAYLOAD) get_image(payload_index).ref_count += 1;
+		}
+		for (i64 payload_index = 0; payload_index < header.payloads_count; ++payload_index) {
+			auto& image = get_image(payload_index);
+			if (image.ref_count == 1) image.ref_count = 0;
+		}
+
+		file.count = payloads_offset + header.payloads_count * payload_size;
+		return file;
+	}
+
+	// чанки ссылаются прямо на образы в file, поэтому file должен жить столько же, сколько map
+	static bool load_world(Map& map, slice<u8> file, u32 generator_version) {
+		if (file.get_size() < size_of(World_File_Header)) return false;
+
+		auto& header = cast<World_File_Header&>(*file.ptr);
+		i64 chunks_count = cast<i64>(map.chunks.count_x) * map.chunks.count_y * map.chunks.count_z;
+
+		// смещения и количество проверяем до умножения, чтобы битый файл не переполнил i64
+		bool is_valid = header.magic == WORLD_FILE_MAGIC &&
+		                header.version == WORLD_FILE_VERSION &&
+		                header.generator_version == generator_version &&
+		                header.chunks_count_x == map.chunks.count_x &&
+		                header.chunks_count_y == map.chunks.count_y &&
+		                header.chunks_count_z == map.chunks.count_z &&
+		                header.payload_size == get_world_file_payload_size() &&
+		                header.index_offset >= size_of(World_File_Header) &&
+		                header.index_offset % alignof(u32) == 0 &&
+		                header.index_offset <= file.get_size() &&
+		                header.payloads_offset >= 0 &&
+		                header.payloads_offset <= file.get_size() &&
+		                header.payloads_offset % WORLD_FILE_PAGE_SIZE == 0 &&
+		                header.payloads_count >= 0 &&
+		                header.payloads_count <= (file.get_size() - header.payloads_offset) / header.payload_size &&
+		                header.index_offset + chunks_count * size_of(u32) <= header.payloads_offset;
+		if (!is_valid) return false;
+
+		slice<u32> index = { cast<u32*>(file.ptr + header.index_offset), chunks_count };
+		for (u32 payload_index : index) {
+			if (payload_index != WORLD_FILE_NO_PAYLOAD && payload_index >= header.payloads_count) return false;
+		}
+
+		for (i64 chunk_index = 0; chunk_index < chunks_count; ++chunk_index) {
+			auto& chunk = map.chunks.ptr[chunk_index];
+			u32 payload_index = index(chunk_index);
+
+			chunk = {};
+			if (payload_index == WORLD_FILE_NO_PAYLOAD) continue;
+
+			chunk.tiles = cast<Chunk_Tiles*>(file.ptr + header.payloads_offset + payload_index * header.payload_size);
+			chunk.is_dirty = true; // в файле пейджера этого чанка ещё нет
+			map.resident_count += 1;
+		}
+		return true;
+	}
+
+	static i64 get_world_file_payload_size() {
+		return (size_of(Chunk_Tiles) + WORLD_FILE_PAYLOAD_ALIGN - 1) / WORLD_FILE_PAYLOAD_ALIGN * WORLD_FILE_PAYLOAD_ALIGN;
+	}
+
+	// тайлы нового чанка не заполнены
+	static Chunk_Tiles* add_chunk_tiles(Arena& world_arena, Map& map, Chunk& chunk) {
+		assert(!chunk.tiles && (chunk.state == Chunk_State::Resident || chunk.state == Chunk_State::Generating));
+		chunk.tiles = alloc_chunk_tiles(world_arena, map);
+		chunk.is_dirty = true;
+		map.resident_count += 1;
+		return chunk.tiles;
+	}
+
+	static Chunk_Tiles* alloc_chunk_tiles(Arena& world_arena, Map& map) {
+		Chunk_Tiles* tiles = map.tiles_pool.alloc(world_arena);
+		tiles->ref_count = 0;
+		tiles->next = nullptr;
+		return tiles;
+	}
+
+	// образ из файла мира тоже попадает в пул и дальше используется как обычный блок
+	static void free_chunk_tiles(Map& map, Chunk_Tiles* tiles) {
+		assert(!tiles->ref_count);
+		map.tiles_pool.free(tiles);
+	}
+
+	static Chunk_Tiles*& get_shared_hash_bucket(Map& map, u64 hash) {
+		return map.shared_hash(cast<i32>(hash & (SHARED_TILES_HASH_COUNT - 1)));
+	}
+
+	// FNV-1a
+	static u64 get_tiles_hash(Chunk_Tiles& tiles) {
+		u64 hash = 14695981039346656037ull;
+		for (auto tile : tiles.tiles) {
+			hash ^= cast<u64>(tile);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static bool check_same_tiles(Chunk_Tiles& a, Chunk_Tiles& b) {
+		for (i32 i = 0; i < CHUNK_TILES_COUNT; ++i) {
+			if (a.tiles(i) != b.tiles(i)) return false;
+		}
+		return true;
 	}
 
 	static Chunk* get_chunk(Map& map, i32 abs_x, i32 abs_y, i32 abs_z) {
@@ -68,6 +347,154 @@ namespace Tiles {
 		return result;
 	}
 
+	static void update_pager(Game::Thread& thread, Arena& world_arena, Map& map, Pager& pager, Position& camera_pos, v2<f32> velocity) {
+		if (!pager.queue) return;
+		pager.frame_index += 1;
+
+		for (auto& job : pager.jobs) {
+			if (job.is_used && job.is_done) finish_pager_job(map, pager, job);
+		}
+
+		auto camera_key = get_chunk_lookup_key(camera_pos.abs_xy.x, camera_pos.abs_xy.y, camera_pos.abs_z);
+		use_chunks_around(thread, world_arena, map, pager, camera_key);
+
+		// заранее подгружаем чанки, к которым движется герой
+		Position prefetch_pos = camera_pos;
+		prefetch_pos.tile_rel_add(velocity * PAGER_PREFETCH_SECONDS);
+		auto prefetch_key = get_chunk_lookup_key(prefetch_pos.abs_xy.x, prefetch_pos.abs_xy.y, prefetch_pos.abs_z);
+		if (prefetch_key.x != camera_key.x || prefetch_key.y != camera_key.y) {
+			use_chunks_around(thread, world_arena, map, pager, prefetch_key);
+		}
+
+		if (map.resident_count > PAGER_MAX_RESIDENT_CHUNKS) {
+			evict_chunks(thread, map, pager, map.resident_count - PAGER_MAX_RESIDENT_CHUNKS + PAGER_EVICT_BATCH);
+		}
+	}
+
+	static void use_chunks_around(Game::Thread& thread, Arena& world_arena, Map& map, Pager& pager, Chunk_Lookup_Key center) {
+		// все этажи, потому что лестница переносит героя мгновенно
+		for (        i32 key_z = 0; key_z < map.chunks.count_z; ++key_z) {
+			for (    i32 key_y = center.y - PAGER_KEEP_RADIUS_CHUNKS; key_y <= center.y + PAGER_KEEP_RADIUS_CHUNKS; ++key_y) {
+				for (i32 key_x = center.x - PAGER_KEEP_RADIUS_CHUNKS; key_x <= center.x + PAGER_KEEP_RADIUS_CHUNKS; ++key_x) {
+					if (key_x < 0 || key_x >= map.chunks.count_x || key_y < 0 || key_y >= map.chunks.count_y) continue;
+
+					auto& chunk = map.chunks(key_x, key_y, key_z);
+					chunk.last_used_frame = pager.frame_index;
+					if (chunk.state != Chunk_State::On_Disk) continue;
+
+					// задачи кончились, но отметку ставим всем чанкам вокруг, чтобы их не выгрузили
+					auto* job = get_free_pager_job(pager);
+					if (!job) continue;
+
+					chunk.state = Chunk_State::Loading;
+					map.resident_count += 1;
+					start_pager_job(thread, map, pager, *job, chunk, alloc_chunk_tiles(world_arena, map), false);
+				}
+			}
+		}
+	}
+
+	static void evict_chunks(Game::Thread& thread, Map& map, Pager& pager, i32 count) {
+		// count самых давно использованных чанков, отсортированы от старых к новым
+		Array<Chunk*, PAGER_EVICT_BATCH> victims = {};
+		i32 victims_count = 0;
+		count = hm::min(count, PAGER_EVICT_BATCH);
+
+		for (auto& chunk : map.chunks) {
+			if (chunk.state != Chunk_State::Resident || !chunk.tiles || chunk.last_used_frame == pager.frame_index) continue;
+			if (victims_count == count && chunk.last_used_frame >= victims(count - 1)->last_used_frame) continue;
+
+			i32 index = hm::min(victims_count, count - 1);
+			victims_count = hm::min(victims_count + 1, count);
+			while (index > 0 && victims(index - 1)->last_used_frame > chunk.last_used_frame) {
+				victims(index) = victims(index - 1);
+				index -= 1;
+			}
+			victims(index) = &chunk;
+		}
+
+		for (i32 i = 0; i < victims_count; ++i) {
+			auto& chunk = *victims(i);
+			if (!chunk.is_dirty) {
+				release_chunk_tiles(map, chunk.tiles);
+				chunk.tiles = nullptr;
+				chunk.state = Chunk_State::On_Disk;
+				map.resident_count -= 1;
+				continue;
+			}
+
+			auto* job = get_free_pager_job(pager);
+			if (!job) return;
+
+			// пока тайлы пишутся, чанк остаётся доступным на чтение
+			chunk.state = Chunk_State::Saving;
+			start_pager_job(thread, map, pager, *job, chunk, chunk.tiles, true);
+		}
+	}
+
+	static Pager_Job* get_free_pager_job(Pager& pager) {
+		for (auto& job : pager.jobs) {
+			if (!job.is_used) return &job;
+		}
+		return nullptr;
+	}
+
+	static void start_pager_job(Game::Thread& thread, Map& map, Pager& pager, Pager_Job& job, Chunk& chunk, Chunk_Tiles* tiles, bool is_write) {
+		job = {};
+		job.pager = &pager;
+		job.chunk = &chunk;
+		job.tiles = tiles;
+		job.file_offset = (&chunk - map.chunks.ptr) * size_of(tiles->tiles);
+		job.is_used = true;
+		job.is_write = is_write;
+		pager.add_work(thread, *pager.queue, do_pager_job, &job);
+	}
+
+	static void finish_pager_job(Map& map, Pager& pager, Pager_Job& job) {
+		auto& chunk = *job.chunk;
+
+		if (job.is_write) {
+			assert(chunk.state == Chunk_State::Saving);
+			chunk.state = Chunk_State::Resident;
+			chunk.is_dirty = !job.ok;
+
+			// чанк снова понадобился, пока писался на диск
+			bool is_used_recently = chunk.last_used_frame + 1 >= pager.frame_index;
+			if (job.ok && !is_used_recently) {
+				release_chunk_tiles(map, chunk.tiles);
+				chunk.tiles = nullptr;
+				chunk.state = Chunk_State::On_Disk;
+				map.resident_count -= 1;
+			}
+		} else {
+			assert(chunk.state == Chunk_State::Loading);
+			if (job.ok) {
+				chunk.tiles = job.tiles;
+				chunk.state = Chunk_State::Resident;
+				chunk.is_dirty = false;
+				share_chunk_tiles(map, chunk);
+			} else {
+				free_chunk_tiles(map, job.tiles);
+				chunk.state = Chunk_State::On_Disk;
+				map.resident_count -= 1;
+			}
+		}
+
+		job = {};
+	}
+
+	// выполняется в фоновом потоке, трогает только job
+	static void do_pager_job(Game::Thread& thread, void* data) {
+		auto& job = *cast<Pager_Job*>(data);
+		auto& pager = *job.pager;
+
+		slice<u8> block = { job.tiles->tiles.ptr, job.tiles->tiles.get_count() };
+		job.ok = job.is_write
+			? pager.write_file_block(thread, pager.file, job.file_offset, block)
+			: pager.read_file_block(thread,  pager.file, job.file_offset, block);
+		job.is_done = true;
+	}
+
 	void Position::normalize() {
 		auto& pos = *this;
 
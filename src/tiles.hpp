@@ -1,6 +1,7 @@
 #pragma once
 
 #include "globals.hpp"
+#include "platform.hpp"
 
 namespace Tiles {
 	static constexpr i32 WORLD_X_CHUNKS = 128;
@@ -10,6 +11,20 @@ namespace Tiles {
 	static constexpr i32 CHUNK_LOOKUP_KEY_SHIFT = 4;
 	static constexpr i32 CHUNK_DIM_TILES = 1 << CHUNK_LOOKUP_KEY_SHIFT;
 	static constexpr i32 CHUNK_REL_POSITION_MASK = CHUNK_DIM_TILES - 1;
+	static constexpr i32 CHUNK_TILES_COUNT = CHUNK_DIM_TILES * CHUNK_DIM_TILES;
+	static constexpr i32 SHARED_TILES_HASH_COUNT = 4096; // степень двойки
+
+	static constexpr u32 WORLD_FILE_MAGIC = 'H' | 'M' << 8 | 'W' << 16 | 'F' << 24;
+	static constexpr u32 WORLD_FILE_VERSION = 1;
+	static constexpr u32 WORLD_FILE_NO_PAYLOAD = UINT32_MAX;
+	static constexpr i64 WORLD_FILE_PAGE_SIZE = 4_KB;
+	static constexpr i64 WORLD_FILE_PAYLOAD_ALIGN = 64;
+
+	static constexpr i32 PAGER_MAX_RESIDENT_CHUNKS = 256;
+	static constexpr i32 PAGER_EVICT_BATCH = 16;
+	static constexpr i32 PAGER_MAX_JOBS = 32;
+	static constexpr i32 PAGER_KEEP_RADIUS_CHUNKS = 1;
+	static constexpr f32 PAGER_PREFETCH_SECONDS = 1.0f;
 	static constexpr f32 TILE_DIM = 1.4f;
 
 	enum struct Tile {
@@ -17,17 +32,87 @@ namespace Tiles {
 		Floor,
 		Wall,
 		Stairs_Up,
-		Stairs_Down
+		Stairs_Down,
+		Not_Generated // заглушка для чанков, которые генерируются в фоне, по ней нельзя ходить
+	};
+
+	// одинаковые по содержимому тайлы нескольких чанков хранятся один раз
+	struct Chunk_Tiles {
+		Array<Tile, CHUNK_TILES_COUNT> tiles;
+		u64 hash;
+		i32 ref_count;     // 0 если тайлы принадлежат одному чанку и их можно менять на месте
+		Chunk_Tiles* next; // цепочка в хеш-таблице
+
+		__forceinline
+		Tile& operator()(i32 x, i32 y) {
+			assert(x >= 0 && x < CHUNK_DIM_TILES);
+			assert(y >= 0 && y < CHUNK_DIM_TILES);
+			return tiles(y * CHUNK_DIM_TILES + x);
+		}
+	};
+
+	enum struct Chunk_State : u8 {
+		Resident, // в том числе чанк, который ещё ни разу не заполнялся
+		Saving,
+		On_Disk,
+		Loading,
+		Generating, // тайлы ещё не заполнены генератором мира
 	};
 
 	struct Chunk {
-		static_slice<Tile, CHUNK_DIM_TILES, CHUNK_DIM_TILES> tiles;
+		Chunk_Tiles* tiles; // nullptr пока чанк не в памяти
+		u32 last_used_frame;
+		Chunk_State state;
+		bool is_dirty;      // отличается от копии на диске
+		u16 tiles_version;  // растёт при каждой записи тайла, по нему пересчитываются производные данные
 	};
 
     struct Map {
 		slice3<Chunk> chunks;
+		Array<Chunk_Tiles*, SHARED_TILES_HASH_COUNT> shared_hash;
+		Pool<Chunk_Tiles, CACHE_LINE_SIZE> tiles_pool;
+		i32 resident_count;
     };
 
+	// заголовок, индекс с номером образа для каждого чанка, образы Chunk_Tiles.
+	// Образы начинаются с границы страницы и используются прямо из отображения файла
+	struct World_File_Header {
+		u32 magic;
+		u32 version;
+		u32 generator_version;
+		i32 chunks_count_x;
+		i32 chunks_count_y;
+		i32 chunks_count_z;
+		i64 index_offset;
+		i64 payloads_offset;
+		i64 payloads_count;
+		i64 payload_size;
+	};
+
+	struct Pager;
+
+	struct Pager_Job {
+		Pager* pager;
+		Chunk* chunk;
+		Chunk_Tiles* tiles;
+		i64 file_offset;
+		bool is_used;
+		bool is_write;
+		bool ok;
+		volatile bool is_done;
+	};
+
+	// держит в памяти не больше PAGER_MAX_RESIDENT_CHUNKS чанков, остальные выгружает в файл
+	struct Pager {
+		Game::File file;
+		Game::Work_Queue* queue;
+		Game::Add_Work* add_work;
+		Game::Read_File_Block* read_file_block;
+		Game::Write_File_Block* write_file_block;
+		Array<Pager_Job, PAGER_MAX_JOBS> jobs;
+		u32 frame_index;
+	};
+
 	struct Position {
 		v2<i32> abs_xy;   // нижние CHUNK_LOOKUP_KEY_SHIFT бит это координаты ячейки внутри чанка, верхние биты это координаты чанка в мире
 		i32 abs_z;          // просто координата чанка в мире
@@ -46,10 +131,36 @@ namespace Tiles {
 
 	static bool check_same_tile(Position& pos1, Position& pos2);
 	static bool check_walkable_tile(Map& map, Position& pos);
+	static bool check_walkable(Tile tile);
 
 	static Tile get_tile(Map& map, i32 abs_x, i32 abs_y, i32 abs_z);
 	static void set_tile(Arena& world_arena, Map& map, i32 abs_x, i32 abs_y, i32 abs_z, Tile value);
 
+	static void share_chunks(Map& map, v2<i32> abs_min, v2<i32> abs_max, i32 abs_z);
+	static void share_chunk_tiles(Map& map, Chunk& chunk);
+	static void unshare_chunk_tiles(Arena& world_arena, Map& map, Chunk& chunk);
+	static Chunk_Tiles* add_chunk_tiles(Arena& world_arena, Map& map, Chunk& chunk);
+	static Chunk_Tiles* alloc_chunk_tiles(Arena& world_arena, Map& map);
+	static void free_chunk_tiles(Map& map, Chunk_Tiles* tiles);
+	static Chunk_Tiles*& get_shared_hash_bucket(Map& map, u64 hash);
+	static u64 get_tiles_hash(Chunk_Tiles& tiles);
+	static bool check_same_tiles(Chunk_Tiles& a, Chunk_Tiles& b);
+	static void release_chunk_tiles(Map& map, Chunk_Tiles* tiles);
+
+	static void unlink_shared_tiles(Map& map, Chunk_Tiles& tiles);
+
+	static slice<u8> save_world(Game::Thread& thread, Arena& scratch_arena, Map& map, Pager& pager, u32 generator_version);
+	static bool load_world(Map& map, slice<u8> file, u32 generator_version);
+	static i64 get_world_file_payload_size();
+
+	static void update_pager(Game::Thread& thread, Arena& world_arena, Map& map, Pager& pager, Position& camera_pos, v2<f32> velocity);
+	static void use_chunks_around(Game::Thread& thread, Arena& world_arena, Map& map, Pager& pager, Chunk_Lookup_Key center);
+	static void evict_chunks(Game::Thread& thread, Map& map, Pager& pager, i32 count);
+	static Pager_Job* get_free_pager_job(Pager& pager);
+	static void start_pager_job(Game::Thread& thread, Map& map, Pager& pager, Pager_Job& job, Chunk& chunk, Chunk_Tiles* tiles, bool is_write);
+	static void finish_pager_job(Map& map, Pager& pager, Pager_Job& job);
+	static void do_pager_job(Game::Thread& thread, void* data);
+
 	static Chunk* get_chunk(Map& map, i32 abs_x, i32 abs_y, i32 abs_z);
 	static Chunk_Lookup_Key get_chunk_lookup_key(i32 abs_x, i32 abs_y, i32 abs_z);
 	static v2<i32> get_chunk_rel_position(i32 abs_x, i32 abs_y);
@@ -1,6 +1,8 @@
 #include "win32_handmade.hpp"
 
 static Screen global_screen = create_screen(); // глобальный из-за WindowProc
+static i64 global_large_page_size; // 0 = большие страницы недоступны или выключены
+static i64 global_asset_cache_size; // 0 = размер по умолчанию у игры
 
 int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine, int nCmdShow) {
 	static_assert(DEV_MODE || !SLOW_MODE);
@@ -8,6 +10,40 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
     BOOL ok_priority = SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
 	assert(ok_priority);
 
+	// опции в любом порядке, значения идут через пробел за именем опции
+
+	// -small-pages: память игры на обычных страницах
+	if (!find_option(pCmdLine, L"-small-pages")) global_large_page_size = enable_large_pages();
+
+	// -asset-cache <MB>: бюджет кэша битмапов
+	i32 asset_cache_mb = 0;
+	PWSTR asset_cache_option = find_option(pCmdLine, L"-asset-cache");
+	if (asset_cache_option && swscanf_s(asset_cache_option, L"-asset-cache %d", &asset_cache_mb) == 1 && asset_cache_mb > 0) {
+		global_asset_cache_size = asset_cache_mb * 1_MB;
+	}
+
+	// -memory-json <файл>: с -server отчёт о памяти после каждого тика
+	wchar_t memory_json_path[MAX_PATH] = {};
+	PWSTR memory_json_option = find_option(pCmdLine, L"-memory-json");
+	if (memory_json_option) swscanf_s(memory_json_option, L"-memory-json %259s", memory_json_path, cast<u32>(ARRAYSIZE(memory_json_path)));
+
+	// -server <тиков>: одна симуляция без окна так быстро, как получится
+	// -batch <миров> <тиков>: пакетный прогон независимых миров без окна
+	// Без чисел или с неверными числами оба печатают, как их звать
+	PWSTR server_option = find_option(pCmdLine, L"-server");
+	if (server_option) {
+		i32 server_ticks_count = 0;
+		swscanf_s(server_option, L"-server %d", &server_ticks_count);
+		return run_server(server_ticks_count, memory_json_path[0] ? memory_json_path : nullptr);
+	}
+	PWSTR batch_option = find_option(pCmdLine, L"-batch");
+	if (batch_option) {
+		i32 batch_worlds_count = 0;
+		i32 batch_ticks_count = 0;
+		swscanf_s(batch_option, L"-batch %d %d", &batch_worlds_count, &batch_ticks_count);
+		return run_batch(batch_worlds_count, batch_ticks_count);
+	}
+
 	bool is_pause = false;
 	HWND window = create_window(hInstance);
 	WINDOWPLACEMENT window_placement = { sizeof(window_placement) };
@@ -16,7 +52,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 	auto input = create_input();
 	auto sound = create_sound(window);
 	auto game_code = create_game_code();
-	auto game_memory = create_game_memory();
+	auto game_memory = create_game_memory(nullptr);
 	auto replayer = create_replayer(game_memory);
 
 	i64 flip_timestamp = get_timestamp();
@@ -49,6 +85,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 						if (!is_key_pressed) continue;
 						if (message.wParam == 'P') is_pause = !is_pause;
 						if (message.wParam == 'R') replayer_next_state(replayer, game_memory, input.game_input);
+						if (message.wParam == 'M') write_memory_report_file(game_memory);
 					}
 				} break;
 				default: {
@@ -63,7 +100,7 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 		}
 
 		if constexpr (DEV_MODE) {
-			reload_game_code_if_recompiled(game_code);
+			reload_game_code_if_recompiled(game_code, game_memory);
 			if (is_pause) {
 				wait_until_end_of_frame(flip_timestamp);
 				flip_timestamp = get_timestamp();
@@ -72,7 +109,11 @@ int WINAPI wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR pCmdLine
 			replayer_record_or_replace(replayer, game_memory, input.game_input);
 		}
 
-		game_code.update_and_render(thread, input.game_input, game_memory, global_screen.game_screen);
+		game_code.simulate(thread, input.game_input, game_memory);
+		if constexpr (DEV_MODE) {
+			replayer_record_or_check(replayer, game_memory, input.game_input);
+		}
+		game_code.render(thread, game_memory, global_screen.game_screen);
 		calc_sound_samples_to_write(sound, flip_timestamp);
 		game_code.get_sound_samples(thread, game_memory, sound.game_sound);
 		submit_sound(sound);
@@ -252,28 +293,394 @@ static i64 get_timestamp() {
 	return performance_counter_result.QuadPart;
 }
 
-static Game::Memory create_game_memory() {
+static Game::Memory create_game_memory(bool* is_large_pages) {
+	void* base_address = DEV_MODE && UINTPTR_MAX == UINT64_MAX ? (void*)1024_GB : nullptr;
+	auto game_memory = allocate_game_memory(1_GB, base_address, global_large_page_size, is_large_pages);
+	assert(game_memory.permanent.ptr);
+	game_memory.asset_cache_size = global_asset_cache_size;
+
+	SYSTEM_INFO system_info = {};
+	GetSystemInfo(&system_info);
+	i32 workers_count = hm::max(cast<i32>(system_info.dwNumberOfProcessors) - 1, 1);
+
+	game_memory.high_priority_queue = create_work_queue(workers_count);
+	game_memory.low_priority_queue  = create_work_queue(1);
+	return game_memory;
+}
+
+// без очередей: вся работа игры идёт в потоке, который её вызвал. Если памяти нет, возвращает пустую
+static Game::Memory allocate_game_memory(i64 transient_size, void* base_address, i64 large_page_size, bool* is_large_pages) {
 	constexpr i64 permanent_size = 64_MB;
-	constexpr i64 transient_size = 1_GB;
 	static_assert(permanent_size >= size_of(Game::Game_State));
+	i64 storage_size = permanent_size + transient_size;
 
-	void* base_address = DEV_MODE && UINTPTR_MAX == UINT64_MAX ? (void*)1024_GB : nullptr;
-	u8* game_storage = cast<u8*>(VirtualAlloc(base_address, cast<SIZE_T>(permanent_size + transient_size), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
-	assert_or_return(game_storage);
+	// большие страницы берутся сразу физической памятью и могут не найтись, тогда обычные.
+	// Базовый адрес кратен любому размеру большой страницы, так что реплеи работают в обоих случаях
+	u8* game_storage = nullptr;
+	if (large_page_size && storage_size % large_page_size == 0) {
+		game_storage = cast<u8*>(VirtualAlloc(base_address, cast<SIZE_T>(storage_size), MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+	}
+	if (is_large_pages) *is_large_pages = game_storage != nullptr;
+	if (!game_storage) {
+		game_storage = cast<u8*>(VirtualAlloc(base_address, cast<SIZE_T>(storage_size), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	}
+	if (!game_storage) return {};
 
 	Game::Memory game_memory = {};
 	game_memory.permanent         = { game_storage,                  permanent_size };
 	game_memory.transient         = { game_storage + permanent_size, transient_size };
-	game_memory.read_file  = Game::read_file;
-	game_memory.write_file = Game::write_file;
-	game_memory.free_file  = Game::free_file;
+	game_memory.get_file_size = Game::get_file_size;
+	game_memory.read_file     = Game::read_file;
+	game_memory.write_file    = Game::write_file;
+	game_memory.map_file      = Game::map_file;
+	game_memory.unmap_file    = Game::unmap_file;
+	game_memory.open_file             = Game::open_file;
+	game_memory.open_file_for_reading = Game::open_file_for_reading;
+	game_memory.close_file            = Game::close_file;
+	game_memory.read_file_block  = Game::read_file_block;
+	game_memory.write_file_block = Game::write_file_block;
+	game_memory.add_work          = Game::add_work;
+	game_memory.complete_all_work = Game::complete_all_work;
 	return game_memory;
 }
 
+static Game::Work_Queue* create_work_queue(i32 threads_count) {
+	auto* queue = cast<Game::Work_Queue*>(VirtualAlloc(nullptr, sizeof(Game::Work_Queue), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	assert_or_return(queue);
+
+	LONG max_count = queue->entries.get_count();
+	queue->semaphore = CreateSemaphoreA(nullptr, 0, max_count, nullptr);
+	assert_or_return(queue->semaphore);
+
+	for (i32 i = 0; i < threads_count; ++i) {
+		HANDLE thread_handle = CreateThread(nullptr, 0, work_queue_thread_proc, queue, 0, nullptr);
+		assert_or_return(thread_handle);
+		CloseHandle(thread_handle);
+	}
+	return queue;
+}
+
+static DWORD WINAPI work_queue_thread_proc(LPVOID param) {
+	auto& queue = *cast<Game::Work_Queue*>(param);
+	Game::Thread thread = {};
+
+	while (true) {
+		if (!do_next_work_queue_entry(thread, queue)) {
+			WaitForSingleObjectEx(queue.semaphore, INFINITE, FALSE);
+		}
+	}
+}
+
+// false если очередь пуста
+static bool do_next_work_queue_entry(Game::Thread& thread, Game::Work_Queue& queue) {
+	LONG entry_index = queue.next_entry_to_read;
+	if (entry_index == queue.next_entry_to_write) return false;
+
+	LONG next_entry_index = (entry_index + 1) % queue.entries.get_count();
+	if (InterlockedCompareExchange(&queue.next_entry_to_read, next_entry_index, entry_index) == entry_index) {
+		auto entry = queue.entries(cast<i32>(entry_index));
+		entry.callback(thread, entry.data);
+		InterlockedIncrement(&queue.completion_count);
+	}
+	return true;
+}
+
+// код игры в очередях должен закончить работу до перезагрузки dll и до подмены памяти реплеем
+static void complete_all_game_work(Game::Memory& game_memory) {
+	Game::Thread thread = {};
+	if (game_memory.high_priority_queue) Game::complete_all_work(thread, *game_memory.high_priority_queue);
+	if (game_memory.low_priority_queue)  Game::complete_all_work(thread, *game_memory.low_priority_queue);
+}
+
+// тик за вызов simulate без ожидания кадра, очереди те же что у игры, так что параллельные тики тоже меряются
+static int run_server(i32 ticks_count, PWSTR memory_json_path) {
+	attach_console();
+	if (ticks_count <= 0) {
+		printf("usage: -server <ticks> [-memory-json <file>]\n");
+		return 1;
+	}
+
+	// массив отчётов по тикам. Запись идёт внутри замера и замедляет его
+	FILE* memory_json = nullptr;
+	if (memory_json_path) {
+		if (_wfopen_s(&memory_json, memory_json_path, L"w") || !memory_json) {
+			printf("server: can't open %ls\n", memory_json_path);
+			return 1;
+		}
+		fprintf(memory_json, "[");
+	}
+
+	Game::Thread thread = {};
+	auto game_code = create_game_code();
+	bool is_large_pages = false;
+	auto game_memory = create_game_memory(&is_large_pages);
+	game_memory.is_headless = true;
+	Game::Input game_input = {};
+	game_input.frame_dt = Game::SIM_TICK_DT;
+
+	// первый вызов грузит или генерирует мир, его в замер не берём
+	game_code.simulate(thread, game_input, game_memory);
+	game_memory.phase_cycles = {};
+
+	i64 start_timestamp = get_timestamp();
+	u64 start_cycles = __rdtsc();
+	for (i32 tick = 0; tick < ticks_count; ++tick) {
+		game_code.simulate(thread, game_input, game_memory);
+		if (memory_json) {
+			fprintf(memory_json, "%s\n{\"tick\": %d, \"memory\": ", tick ? "," : "", tick);
+			print_memory_report(memory_json, game_memory, true);
+			fprintf(memory_json, "}");
+		}
+	}
+	f32 seconds = get_seconds_elapsed(start_timestamp);
+	if (memory_json) {
+		fprintf(memory_json, "\n]\n");
+		fclose(memory_json);
+	}
+	f32 cycles_per_ms = cast<f32>(__rdtsc() - start_cycles) / (seconds * 1000);
+	complete_all_game_work(game_memory);
+
+	printf("server: %d ticks in %.2f s, %.0f ticks/s\n", ticks_count, seconds, cast<f32>(ticks_count) / seconds);
+	cstr phase_names[] = { "world", "sim", "pathfinder" };
+	for (i32 phase = 0; phase < Game::Phase::Render; ++phase) {
+		f32 phase_ms = cast<f32>(game_memory.phase_cycles(phase)) / cycles_per_ms;
+		printf("  %-10s %8.4f ms/tick %5.1f%%\n", phase_names[phase], phase_ms / ticks_count, phase_ms / (seconds * 10));
+	}
+	print_memory_report(stdout, game_memory, false);
+
+	// разница между обходами и есть выигрыш больших страниц на промахах TLB
+	bool is_scan_large_pages = false;
+	f32 large_scan_ns = measure_world_scan_ns(game_code, global_large_page_size, &is_scan_large_pages);
+	f32 small_scan_ns = measure_world_scan_ns(game_code, 0, nullptr);
+	printf("large pages: %s\n", is_large_pages ? "yes" : "no");
+	if (!is_scan_large_pages) {
+		printf("world scan: %.2f ns/tile, large pages unavailable for comparison\n", small_scan_ns);
+	} else {
+		printf("world scan: %.2f ns/tile large pages, %.2f ns/tile small pages, small %+.1f%%\n",
+		       large_scan_ns, small_scan_ns, (small_scan_ns / large_scan_ns - 1) * 100);
+	}
+	return 0;
+}
+
+// размер большой страницы или 0. Нужно право SeLockMemoryPrivilege (Lock pages in memory в локальной политике)
+static i64 enable_large_pages() {
+	HANDLE token = nullptr;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return 0;
+	defer(CloseHandle(token));
+
+	TOKEN_PRIVILEGES privileges = {};
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+	if (!LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)) return 0;
+
+	// без права AdjustTokenPrivileges всё равно успешен, но ставит ERROR_NOT_ALL_ASSIGNED
+	BOOL ok_adjust = AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr);
+	if (!ok_adjust || GetLastError() != ERROR_SUCCESS) return 0;
+	return cast<i64>(GetLargePageMinimum());
+}
+
+// get_tile по всему миру в отдельной памяти. Очередей у неё нет, так что пейджер ничего не выгружает
+// и обход одинаковый при любых страницах. Мир генерируется в памяти игры, а не берётся из отображения world.hmw,
+// иначе тайлы лежали бы на обычных страницах файла в обоих замерах
+static f32 measure_world_scan_ns(Game_Code& game_code, i64 large_page_size, bool* is_large_pages) {
+	auto game_memory = allocate_game_memory(BATCH_TRANSIENT_SIZE, nullptr, large_page_size, is_large_pages);
+	if (!game_memory.permanent.ptr) return 0;
+	defer(VirtualFree(game_memory.permanent.ptr, 0, MEM_RELEASE));
+	game_memory.is_headless = true;
+	game_memory.is_world_in_memory = true;
+
+	Game::Thread thread = {};
+	Game::Input game_input = {};
+	game_input.frame_dt = Game::SIM_TICK_DT;
+	game_code.simulate(thread, game_input, game_memory);
+	defer(game_code.release_world(thread, game_memory));
+
+	volatile u64 sum = game_code.scan_world(thread, game_memory); // обычные страницы получают физическую память при первом касании
+	i64 start_timestamp = get_timestamp();
+	for (i32 i = 0; i < WORLD_SCAN_REPEATS; ++i) sum += game_code.scan_world(thread, game_memory);
+	f32 seconds = get_seconds_elapsed(start_timestamp);
+
+	i64 tiles_count = cast<i64>(Tiles::WORLD_X_CHUNKS) * Tiles::WORLD_Y_CHUNKS * Tiles::WORLD_Z_CHUNKS * Tiles::CHUNK_TILES_COUNT;
+	return seconds * 1e9f / cast<f32>(tiles_count * WORLD_SCAN_REPEATS);
+}
+
+// имя опции целым словом: в начале строки или после пробела и до пробела или конца. nullptr если опции нет
+static PWSTR find_option(PWSTR command_line, PCWSTR name) {
+	size_t name_length = wcslen(name);
+	for (PWSTR found = wcsstr(command_line, name); found; found = wcsstr(found + 1, name)) {
+		bool is_word_start = found == command_line || found[-1] == L' ';
+		bool is_word_end   = found[name_length] == 0 || found[name_length] == L' ';
+		if (is_word_start && is_word_end) return found;
+	}
+	return nullptr;
+}
+
+// каждый поток забирает миры по одному и прогоняет их целиком, миры ничего не делят кроме кода игры
+static int run_batch(i32 worlds_count, i32 ticks_count) {
+	attach_console();
+	if (worlds_count <= 0 || ticks_count <= 0) {
+		printf("usage: -batch <worlds> <ticks>\n");
+		return 1;
+	}
+
+	auto game_code = create_game_code();
+
+	Batch batch = {};
+	batch.game_code = &game_code;
+	batch.ticks_count = ticks_count;
+	batch.worlds.count = worlds_count;
+	batch.worlds.ptr = cast<Batch_World*>(VirtualAlloc(nullptr, cast<SIZE_T>(batch.worlds.get_size()), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+	if (!batch.worlds.ptr) {
+		printf("batch: out of memory\n");
+		return 1;
+	}
+
+	SYSTEM_INFO system_info = {};
+	GetSystemInfo(&system_info);
+	i32 workers_count = hm::max(cast<i32>(system_info.dwNumberOfProcessors) - 1, 1);
+	auto* queue = create_work_queue(workers_count);
+
+	Game::Thread thread = {};
+	i64 start_timestamp = get_timestamp();
+	for (i32 i = 0; i <= workers_count; ++i) {
+		Game::add_work(thread, *queue, do_batch_work, &batch); // главный поток тоже работает, пока ждёт в complete_all_work
+	}
+	Game::complete_all_work(thread, *queue);
+	f32 seconds = get_seconds_elapsed(start_timestamp);
+	if (batch.failed_count) {
+		printf("batch: out of memory for %d worlds\n", cast<i32>(batch.failed_count));
+		return 1;
+	}
+
+	i64 total_ticks = cast<i64>(worlds_count) * ticks_count;
+	printf("batch: %d worlds x %d ticks, %d threads, %.2f s\n", worlds_count, ticks_count, workers_count + 1, seconds);
+	// одновременно считается не больше миров, чем потоков
+	i32 parallel_worlds_count = hm::min(worlds_count, workers_count + 1);
+	printf("%.0f ticks/s total, %.1f ticks/s per world\n", cast<f32>(total_ticks) / seconds, cast<f32>(total_ticks) / seconds / cast<f32>(parallel_worlds_count));
+	return 0;
+}
+
+static void do_batch_work(Game::Thread& thread, void* data) {
+	auto& batch = *cast<Batch*>(data);
+
+	while (true) {
+		i64 world_index = InterlockedIncrement(&batch.next_world) - 1;
+		if (world_index >= batch.worlds.count) break;
+
+		// память мира живёт только пока его считают, одновременно заняты не больше миров, чем потоков
+		auto& world = batch.worlds(world_index);
+		world.memory = allocate_game_memory(BATCH_TRANSIENT_SIZE, nullptr, global_large_page_size, nullptr);
+		if (!world.memory.permanent.ptr) {
+			InterlockedIncrement(&batch.failed_count);
+			continue;
+		}
+		world.memory.is_headless = true;
+		world.input.frame_dt = Game::SIM_TICK_DT; // ровно тик за вызов
+
+		auto& controller = world.input.controllers(0);
+		for (i32 tick = 0; tick < batch.ticks_count; ++tick) {
+			// у каждого мира свой маршрут героя, иначе все миры считали бы одно и то же
+			i64 direction = (world_index + tick / Game::SIM_TICKS_PER_SECOND) % 4;
+			controller.move_left.is_pressed  = direction == 0;
+			controller.move_up.is_pressed    = direction == 1;
+			controller.move_right.is_pressed = direction == 2;
+			controller.move_down.is_pressed  = direction == 3;
+			batch.game_code->simulate(thread, world.input, world.memory);
+		}
+
+		batch.game_code->release_world(thread, world.memory);
+		VirtualFree(world.memory.permanent.ptr, 0, MEM_RELEASE);
+		world.memory = {};
+	}
+}
+
+// у оконного приложения своей консоли нет, пишем в консоль запустившего процесса
+static void attach_console() {
+	if (!AttachConsole(ATTACH_PARENT_PROCESS)) AllocConsole();
+	FILE* stream = nullptr;
+	freopen_s(&stream, "CONOUT$", "w", stdout);
+}
+
+// места вызова по убыванию выделенных байт. Кадровые арены показывают только свой последний кадр
+static void print_memory_report(FILE* stream, Game::Memory& game_memory, bool is_json) {
+	cstr arena_names[] = { "permanent", "world", "transient", "frame_0", "frame_1" };
+	static_assert(ARRAYSIZE(arena_names) == Game::Arena_Id::Count);
+
+	if (is_json) fprintf(stream, "{\"arenas\": [");
+	cstr arena_separator = "";
+	for (i32 arena_id = 0; arena_id < Game::Arena_Id::Count; ++arena_id) {
+		auto* arena = game_memory.arenas(arena_id);
+		if (!arena) continue; // игра ещё не инициализирована
+
+		Array<Arena_Site*, ARENA_MAX_SITES> sites = {};
+		i32 sites_count = 0;
+		i64 lost_count = arena->sites ? arena->sites->lost_count : 0;
+		for (i32 i = 0; arena->sites && i < ARENA_MAX_SITES; ++i) {
+			auto& site = arena->sites->sites(i);
+			if (!site.count) continue;
+
+			i32 j = sites_count;
+			for (; j > 0 && sites(j - 1)->bytes < site.bytes; --j) sites(j) = sites(j - 1);
+			sites(j) = &site;
+			sites_count += 1;
+		}
+
+		if (is_json) {
+			fprintf(stream, "%s\n  {\"name\": \"%s\", \"size\": %lld, \"used\": %lld, \"max_used\": %lld, \"lost_sites\": %lld, \"sites\": [",
+			        arena_separator, arena_names[arena_id], arena->size, arena->used, arena->max_used, lost_count);
+			for (i32 i = 0; i < sites_count; ++i) {
+				auto& site = *sites(i);
+				fprintf(stream, "%s\n    {\"tag\": \"%s\", \"function\": \"%s\", \"file\": \"%s\", \"line\": %d, \"count\": %lld, \"bytes\": %lld}",
+				        i ? "," : "", site.tag.ptr, site.function.ptr, site.file.ptr, site.line, site.count, site.bytes);
+			}
+			fprintf(stream, "]}");
+			arena_separator = ",";
+		} else {
+			f32 mb = cast<f32>(1_MB);
+			fprintf(stream, "%-10s used %9.2f MB, max %9.2f MB of %9.2f MB (%5.1f%%)\n", arena_names[arena_id],
+			        cast<f32>(arena->used) / mb, cast<f32>(arena->max_used) / mb, cast<f32>(arena->size) / mb,
+			        cast<f32>(arena->max_used) * 100 / cast<f32>(arena->size));
+			for (i32 i = 0; i < sites_count; ++i) {
+				auto& site = *sites(i);
+				fprintf(stream, "  %12lld B %8lld x  %-10s %s  %s:%d\n", site.bytes, site.count, site.tag(0) ? site.tag.ptr : "-", site.function.ptr, site.file.ptr, site.line);
+			}
+			if (lost_count) fprintf(stream, "  %lld pushes from sites that did not fit the table\n", lost_count);
+		}
+	}
+
+	// есть только у игры с отрисовкой
+	auto* cache_stats = game_memory.asset_cache_stats;
+	if (is_json) {
+		fprintf(stream, "\n]");
+		if (cache_stats) {
+			fprintf(stream, ", \"asset_cache\": {\"size\": %lld, \"used\": %lld, \"hits\": %lld, \"misses\": %lld, \"evictions\": %lld}",
+			        cache_stats->size, cache_stats->used_size, cache_stats->hits, cache_stats->misses, cache_stats->evictions);
+		}
+		fprintf(stream, "}\n");
+	} else if (cache_stats) {
+		f32 mb = cast<f32>(1_MB);
+		fprintf(stream, "asset cache used %9.2f MB of %9.2f MB, %lld hits, %lld misses, %lld evictions\n",
+		        cast<f32>(cache_stats->used_size) / mb, cast<f32>(cache_stats->size) / mb,
+		        cache_stats->hits, cache_stats->misses, cache_stats->evictions);
+	}
+}
+
+static void write_memory_report_file(Game::Memory& game_memory) {
+	char path[MAX_PATH];
+	get_build_file_path(path, "memory_report.json");
+	FILE* stream = nullptr;
+	if (fopen_s(&stream, path, "w") || !stream) return;
+	print_memory_report(stream, game_memory, true);
+	fclose(stream);
+}
+
 static Game_Code create_game_code() {
 	Game_Code game_code = {};
-	game_code.update_and_render = [](auto...){};
+	game_code.simulate          = [](auto...){};
+	game_code.render            = [](auto...){};
 	game_code.get_sound_samples = [](auto...){};
+	game_code.scan_world        = [](auto...) -> u64 { return 0; };
+	game_code.release_world     = [](auto...){};
 	get_build_file_path(game_code.dll_path, "game.dll");
 	get_build_file_path(game_code.copy_dll_path, "game_copy.dll");
 	get_build_file_path(game_code.lock_path, "lock.tmp");
@@ -281,14 +688,18 @@ static Game_Code create_game_code() {
 	return game_code;
 }
 
-static void reload_game_code_if_recompiled(Game_Code& game_code) {
+static void reload_game_code_if_recompiled(Game_Code& game_code, Game::Memory& game_memory) {
 	FILETIME dll_write_time = get_file_write_time(game_code.dll_path);
 	if (CompareFileTime(&dll_write_time, &game_code.write_time) > 0) {
+		complete_all_game_work(game_memory);
 		BOOL ok_free = FreeLibrary(game_code.dll);
 		assert(ok_free);
 		game_code.dll = nullptr;
-		game_code.update_and_render = [](auto...){};
+		game_code.simulate          = [](auto...){};
+		game_code.render            = [](auto...){};
 		game_code.get_sound_samples = [](auto...){};
+		game_code.scan_world        = [](auto...) -> u64 { return 0; };
+		game_code.release_world     = [](auto...){};
 		load_game_code(game_code);
 	}
 }
@@ -316,8 +727,11 @@ static void load_game_code(Game_Code& game_code) {
 
 	game_code.dll = loaded_dll;
 	game_code.write_time = get_file_write_time(game_code.dll_path);
-	game_code.update_and_render = cast<Game::Update_And_Render*>(GetProcAddress(loaded_dll, "update_and_render"));
+	game_code.simulate          = cast<Game::Simulate*>(GetProcAddress(loaded_dll, "simulate"));
+	game_code.render            = cast<Game::Render*>(GetProcAddress(loaded_dll, "render"));
 	game_code.get_sound_samples = cast<Game::Get_Sound_Samples*>(GetProcAddress(loaded_dll, "get_sound_samples"));
+	game_code.scan_world        = cast<Game::Scan_World*>(GetProcAddress(loaded_dll, "scan_world"));
+	game_code.release_world     = cast<Game::Release_World*>(GetProcAddress(loaded_dll, "release_world"));
 }
 
 static Input create_input() {
@@ -465,15 +879,27 @@ static void replayer_next_state(Replayer& replayer, Game::Memory& game_memory, G
 	}
 }
 
+// до кадра: при проигрывании подменяем вход. Запись идёт после кадра, вместе с получившимся хешем
 static void replayer_record_or_replace(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input) {
 	switch (replayer.state) {
 		case Replayer_State::Idle:                                                        break;
-		case Replayer_State::Recording: replayer_record(replayer, game_input);            break;
+		case Replayer_State::Recording:                                                   break;
 		case Replayer_State::Playing:   replayer_play(replayer, game_memory, game_input); break;
 	}
 }
 
+static void replayer_record_or_check(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input) {
+	switch (replayer.state) {
+		case Replayer_State::Idle:                                                          break;
+		case Replayer_State::Recording: replayer_record(replayer, game_memory, game_input); break;
+		case Replayer_State::Playing:   replayer_check_state_hash(replayer, game_memory);   break;
+	}
+}
+
 static void replayer_start_record(Replayer& replayer, Game::Memory& game_memory) {
+	// LATER: файл выгруженных чанков не попадает в снимок, реплей после выгрузки может расходиться
+	complete_all_game_work(game_memory);
+
 	DWORD state_handle_ptr = SetFilePointer(replayer.state_handle, 0, 0, FILE_BEGIN);
 	DWORD input_handle_ptr = SetFilePointer(replayer.input_handle, 0, 0, FILE_BEGIN);
 	assert_or_return_void(state_handle_ptr != INVALID_SET_FILE_POINTER);
@@ -483,15 +909,19 @@ static void replayer_start_record(Replayer& replayer, Game::Memory& game_memory)
 	DWORD bytes_written = 0;
 	BOOL ok_write = WriteFile(replayer.state_handle, game_memory.permanent.ptr, game_memory_size, &bytes_written, nullptr);
 	assert(ok_write && bytes_written == game_memory_size);
+	replayer.start_state_hash = game_memory.state_hash;
 }
 
-static void replayer_record(Replayer& replayer, Game::Input& game_input) {
+static void replayer_record(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input) {
+	Replay_Frame frame = { game_input, game_memory.state_hash };
 	DWORD bytes_written = 0;
-	BOOL ok_write = WriteFile(replayer.input_handle, &game_input, sizeof(game_input), &bytes_written, nullptr);
-	assert(ok_write && bytes_written == sizeof(game_input));
+	BOOL ok_write = WriteFile(replayer.input_handle, &frame, sizeof(frame), &bytes_written, nullptr);
+	assert(ok_write && bytes_written == sizeof(frame));
 }
 
 static void replayer_start_play(Replayer& replayer, Game::Memory& game_memory) {
+	complete_all_game_work(game_memory);
+
 	DWORD state_handle_ptr = SetFilePointer(replayer.state_handle, 0, 0, FILE_BEGIN);
 	DWORD input_handle_ptr = SetFilePointer(replayer.input_handle, 0, 0, FILE_BEGIN);
 	assert_or_return_void(state_handle_ptr != INVALID_SET_FILE_POINTER);
@@ -501,19 +931,43 @@ static void replayer_start_play(Replayer& replayer, Game::Memory& game_memory) {
 	DWORD bytes_read = 0;
 	BOOL ok_read = ReadFile(replayer.state_handle, game_memory.permanent.ptr, game_memory_size, &bytes_read, nullptr);
 	assert(ok_read && bytes_read == game_memory_size);
+	game_memory.state_hash = replayer.start_state_hash;
+	replayer.is_diverged = false;
 }
 
 static void replayer_play(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input) {
+	auto& frame = replayer.frame;
 	DWORD bytes_read = 0;
-	BOOL ok_read = ReadFile(replayer.input_handle, &game_input, sizeof(game_input), &bytes_read, nullptr);
+	BOOL ok_read = ReadFile(replayer.input_handle, &frame, sizeof(frame), &bytes_read, nullptr);
 	assert_or_return_void(ok_read);
 
 	if (!bytes_read) {
 		replayer_start_play(replayer, game_memory);
-		BOOL ok_read_2 = ReadFile(replayer.input_handle, &game_input, sizeof(game_input), &bytes_read, nullptr);
+		BOOL ok_read_2 = ReadFile(replayer.input_handle, &frame, sizeof(frame), &bytes_read, nullptr);
 		assert_or_return_void(ok_read_2);
 	}
-	assert(bytes_read == sizeof(game_input));
+	assert(bytes_read == sizeof(frame));
+	game_input = frame.input;
+}
+
+// сообщаем только о первом расхождении за проход, дальше состояние уже другое и хеши расходятся все
+static void replayer_check_state_hash(Replayer& replayer, Game::Memory& game_memory) {
+	auto& expected = replayer.frame.state_hash;
+	auto& actual   = game_memory.state_hash;
+	if (replayer.is_diverged || (expected.tick == actual.tick && expected.total == actual.total)) return;
+	replayer.is_diverged = true;
+
+	char output_buffer[256];
+	sprintf_s(output_buffer, "replay diverged at tick %llu (recorded %llu), blocks:", actual.tick, expected.tick);
+	for (i32 block = 0; block < Game::State_Hash_Block::Count; ++block) {
+		if (expected.blocks(block) == actual.blocks(block)) continue;
+
+		char block_buffer[16];
+		sprintf_s(block_buffer, " %d", block);
+		hm::strcat(output_buffer, block_buffer);
+	}
+	hm::strcat(output_buffer, "\n");
+	OutputDebugStringA(output_buffer);
 }
 
 static Screen create_screen() {
@@ -783,32 +1237,25 @@ static void draw_sound_sync(Screen& screen, Sound& sound) {
 }
 
 namespace Game {
-	static slice<u8> read_file(Thread& thread, cstr file_name) {
-		slice<u8> result = {};
+	static i64 get_file_size(Thread& thread, cstr file_name) {
+		WIN32_FILE_ATTRIBUTE_DATA attributes = {};
+		if (!GetFileAttributesExA(file_name, GetFileExInfoStandard, &attributes)) return -1;
+		return (cast<i64>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow;
+	}
 
+	static bool read_file(Thread& thread, cstr file_name, slice<u8> file) {
 		HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
 		assert_or_return(file_handle != INVALID_HANDLE_VALUE);
 		defer(CloseHandle(file_handle));
 
 		LARGE_INTEGER file_size_struct = {};
 		BOOL ok_size = GetFileSizeEx(file_handle, &file_size_struct);
-		DWORD file_size_casted = cast<DWORD>(file_size_struct.QuadPart);
-		result.set_size(file_size_casted);
-		assert_or_return(ok_size);
-
-		HANDLE heap_handle = GetProcessHeap();
-		assert_or_return(heap_handle);
-
-		result.ptr = cast<u8*>(HeapAlloc(heap_handle, 0, file_size_casted));
-		assert_or_return(result.ptr);
+		assert_or_return(ok_size && file_size_struct.QuadPart == file.get_size());
 
+		DWORD file_size_casted = cast<DWORD>(file.get_size());
 		DWORD bytes_read = 0;
-		BOOL ok_read = ReadFile(file_handle, result.ptr, file_size_casted, &bytes_read, nullptr);
-		assert_or_return(ok_read && bytes_read == file_size_casted, {
-			HeapFree(heap_handle, 0, result.ptr);
-		});
-
-		return result;
+		BOOL ok_read = ReadFile(file_handle, file.ptr, file_size_casted, &bytes_read, nullptr);
+		return ok_read && bytes_read == file_size_casted;
 	}
 
 	static void write_file(Thread& thread, cstr file_name, slice<u8> file) {
@@ -823,13 +1270,95 @@ namespace Game {
 		assert(ok_write && bytes_written == file_size_casted);
 	}
 	
-	static void free_file(Thread& thread, void*& memory) {
-		defer(memory = nullptr);
+	static slice<u8> map_file(Thread& thread, cstr file_name) {
+		HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (file_handle == INVALID_HANDLE_VALUE) return {};
+		defer(CloseHandle(file_handle));
 
-		HANDLE heap_handle = GetProcessHeap();
-		assert_or_return_void(heap_handle);
-		
-		BOOL ok_free = HeapFree(heap_handle, 0, memory);
-		assert(ok_free);
+		LARGE_INTEGER file_size_struct = {};
+		BOOL ok_size = GetFileSizeEx(file_handle, &file_size_struct);
+		assert_or_return(ok_size && file_size_struct.QuadPart > 0);
+
+		// отображение живёт, пока открыт view
+		HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		assert_or_return(mapping_handle);
+		defer(CloseHandle(mapping_handle));
+
+		void* view = MapViewOfFile(mapping_handle, FILE_MAP_COPY, 0, 0, 0);
+		assert_or_return(view);
+
+		return { cast<u8*>(view), file_size_struct.QuadPart };
+	}
+
+	static void unmap_file(Thread& thread, slice<u8>& file) {
+		defer(file = {});
+		BOOL ok_unmap = UnmapViewOfFile(file.ptr);
+		assert(ok_unmap);
+	}
+
+	static File open_file(Thread& thread, cstr file_name) {
+		HANDLE file_handle = CreateFileA(file_name, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, 0, nullptr);
+		assert_or_return(file_handle != INVALID_HANDLE_VALUE);
+		return { file_handle };
+	}
+
+	static File open_file_for_reading(Thread& thread, cstr file_name) {
+		HANDLE file_handle = CreateFileA(file_name, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (file_handle == INVALID_HANDLE_VALUE) return {};
+		return { file_handle };
+	}
+
+	static void close_file(Thread& thread, File& file) {
+		defer(file = {});
+		BOOL ok_close = CloseHandle(file.handle);
+		assert(ok_close);
+	}
+
+	static bool read_file_block(Thread& thread, File file, i64 offset, slice<u8> block) {
+		// смещение в OVERLAPPED, чтобы потоки не делили позицию файла
+		OVERLAPPED overlapped = {};
+		overlapped.Offset     = cast<DWORD>(offset & UINT32_MAX);
+		overlapped.OffsetHigh = cast<DWORD>(offset >> 32);
+
+		DWORD block_size_casted = cast<DWORD>(block.get_size());
+		DWORD bytes_read = 0;
+		BOOL ok_read = ReadFile(file.handle, block.ptr, block_size_casted, &bytes_read, &overlapped);
+		return ok_read && bytes_read == block_size_casted;
+	}
+
+	static bool write_file_block(Thread& thread, File file, i64 offset, slice<u8> block) {
+		OVERLAPPED overlapped = {};
+		overlapped.Offset     = cast<DWORD>(offset & UINT32_MAX);
+		overlapped.OffsetHigh = cast<DWORD>(offset >> 32);
+
+		DWORD block_size_casted = cast<DWORD>(block.get_size());
+		DWORD bytes_written = 0;
+		BOOL ok_write = WriteFile(file.handle, block.ptr, block_size_casted, &bytes_written, &overlapped);
+		return ok_write && bytes_written == block_size_casted;
+	}
+
+	static void add_work(Thread& thread, Work_Queue& queue, Work_Callback* callback, void* data) {
+		LONG entry_index = queue.next_entry_to_write;
+		LONG next_entry_index = (entry_index + 1) % queue.entries.get_count();
+		if (next_entry_index == queue.next_entry_to_read) {
+			// очередь переполнена, выполняем сами
+			assert(false);
+			callback(thread, data);
+			return;
+		}
+
+		queue.entries(cast<i32>(entry_index)) = { callback, data };
+		queue.completion_goal += 1;
+		MemoryBarrier(); // запись в entries должна стать видна раньше нового next_entry_to_write
+		queue.next_entry_to_write = next_entry_index;
+		ReleaseSemaphore(queue.semaphore, 1, nullptr);
+	}
+
+	static void complete_all_work(Thread& thread, Work_Queue& queue) {
+		while (queue.completion_goal != queue.completion_count) {
+			if (!do_next_work_queue_entry(thread, queue)) YieldProcessor();
+		}
+		queue.completion_goal = 0;
+		queue.completion_count = 0;
 	}
 }
\ No newline at end of file
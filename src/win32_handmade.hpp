@@ -16,8 +16,11 @@ using X_Input_Set_State = DWORD(DWORD dwUserIndex, XINPUT_VIBRATION *pVibration)
 static constexpr i32 INITIAL_WINDOW_WIDTH = 960;
 static constexpr i32 INITIAL_WINDOW_HEIGHT = 540;
 static constexpr i32 TARGET_FPS = 60;
+static constexpr i64 BATCH_TRANSIENT_SIZE = 128_MB;
+static constexpr i32 WORLD_SCAN_REPEATS = 4;
 
 static i64 get_perf_frequency();
+static PWSTR find_option(PWSTR command_line, PCWSTR name);
 static f32 get_target_seconds_per_frame();
 static const i64 PERF_FREQUENCY = get_perf_frequency();
 static const f32 SLEEP_GRANULARITY_SECONDS = (f32)(timeBeginPeriod(1) == TIMERR_NOERROR) / 1000.0f;
@@ -29,8 +32,40 @@ struct Game_Code {
 	char lock_path[MAX_PATH];
 	HMODULE dll;
 	FILETIME write_time;
-	Game::Update_And_Render* update_and_render;
+	Game::Simulate* simulate;
+	Game::Render* render;
 	Game::Get_Sound_Samples* get_sound_samples;
+	Game::Scan_World* scan_world;
+	Game::Release_World* release_world;
+};
+
+struct Work_Queue_Entry {
+	Game::Work_Callback* callback;
+	void* data;
+};
+
+namespace Game {
+	struct Work_Queue {
+		Array<Work_Queue_Entry, 256> entries;
+		HANDLE semaphore;
+		volatile LONG next_entry_to_write;
+		volatile LONG next_entry_to_read;
+		volatile LONG completion_goal;
+		volatile LONG completion_count;
+	};
+}
+
+struct Batch_World {
+	Game::Memory memory;
+	Game::Input input;
+};
+
+struct Batch {
+	Game_Code* game_code;
+	slice<Batch_World> worlds;
+	i32 ticks_count;
+	volatile LONG next_world;
+	volatile LONG failed_count;
 };
 
 struct Input {
@@ -45,12 +80,21 @@ enum struct Replayer_State {
 	Playing,
 };
 
+// вход кадра и хеш состояния после него
+struct Replay_Frame {
+	Game::Input input;
+	Game::State_Hash state_hash;
+};
+
 struct Replayer {
 	char state_path[MAX_PATH];
 	char input_path[MAX_PATH];
 	HANDLE state_handle;
 	HANDLE input_handle;
 	Replayer_State state;
+	Replay_Frame frame;                  // текущий проигрываемый
+	Game::State_Hash start_state_hash;   // хеш живёт в Game::Memory вне снимка, восстанавливаем его отдельно
+	bool is_diverged;
 };
 
 struct Screen {
@@ -85,11 +129,26 @@ static HWND create_window(HINSTANCE hInstance);
 static LRESULT CALLBACK WindowProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam);
 static void toggle_full_screen(HWND hwnd, WINDOWPLACEMENT& window_placement);
 
-static Game::Memory create_game_memory();
+static Game::Memory create_game_memory(bool* is_large_pages);
+static Game::Memory allocate_game_memory(i64 transient_size, void* base_address, i64 large_page_size, bool* is_large_pages);
+static i64 enable_large_pages();
+static f32 measure_world_scan_ns(Game_Code& game_code, i64 large_page_size, bool* is_large_pages);
+
+static int run_server(i32 ticks_count, PWSTR memory_json_path);
+static int run_batch(i32 worlds_count, i32 ticks_count);
+static void do_batch_work(Game::Thread& thread, void* data);
+static void attach_console();
+static void print_memory_report(FILE* stream, Game::Memory& game_memory, bool is_json);
+static void write_memory_report_file(Game::Memory& game_memory);
+
+static Game::Work_Queue* create_work_queue(i32 threads_count);
+static DWORD WINAPI work_queue_thread_proc(LPVOID param);
+static bool do_next_work_queue_entry(Game::Thread& thread, Game::Work_Queue& queue);
+static void complete_all_game_work(Game::Memory& game_memory);
 
 static Game_Code create_game_code();
 static void load_game_code(Game_Code& game_code);
-static void reload_game_code_if_recompiled(Game_Code& game_code);
+static void reload_game_code_if_recompiled(Game_Code& game_code, Game::Memory& game_memory);
 
 static Input create_input();
 static void reset_input_counters(Input& input);
@@ -102,8 +161,10 @@ static f32 get_normalized_gamepad_stick_value(SHORT value);
 static Replayer create_replayer(Game::Memory& game_memory);
 static void replayer_next_state(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input);
 static void replayer_play(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input);
-static void replayer_record(Replayer& replayer, Game::Input& game_input);
+static void replayer_record(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input);
 static void replayer_record_or_replace(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input);
+static void replayer_record_or_check(Replayer& replayer, Game::Memory& game_memory, Game::Input& game_input);
+static void replayer_check_state_hash(Replayer& replayer, Game::Memory& game_memory);
 static void replayer_start_play(Replayer& replayer, Game::Memory& game_memory);
 static void replayer_start_record(Replayer& replayer, Game::Memory& game_memory);
 